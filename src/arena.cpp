@@ -0,0 +1,114 @@
+#include "arena.h"
+
+#include "df_common.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const size_t ARENA_MIN_BLOCK_SIZE = 64 * 1024;
+enum { ARENA_ALIGNMENT = 16 };
+
+
+// The header takes a whole alignment unit, so the data after it is aligned
+// as long as malloc's result is.
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+    size_t padding;
+
+    u8 *Data() { return (u8 *)(this + 1); }
+};
+
+
+static ArenaBlock *NewBlock(size_t capacity, ArenaBlock *next) {
+    ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + capacity);
+    ReleaseAssert(block, "Out of memory allocating a %d byte arena block", (int)capacity);
+    block->next = next;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+
+static void FreeBlocks(ArenaBlock *block) {
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+
+Arena::Arena() {
+    blocks = NULL;
+}
+
+
+Arena::~Arena() {
+    FreeBlocks(blocks);
+}
+
+
+void *Arena::Alloc(size_t num_bytes) {
+    num_bytes = (num_bytes + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    if (!blocks || blocks->capacity - blocks->used < num_bytes) {
+        // The rest of the current block is wasted. Blocks at least double
+        // in size, so that doesn't add up to much.
+        size_t capacity = blocks ? blocks->capacity * 2 : ARENA_MIN_BLOCK_SIZE;
+        if (capacity < num_bytes) {
+            capacity = num_bytes;
+        }
+        blocks = NewBlock(capacity, blocks);
+    }
+
+    void *rv = blocks->Data() + blocks->used;
+    blocks->used += num_bytes;
+    return rv;
+}
+
+
+void *Arena::AllocZeroed(size_t num_bytes) {
+    void *rv = Alloc(num_bytes);
+    memset(rv, 0, num_bytes);
+    return rv;
+}
+
+
+char *Arena::Printf(const char *fmt, ...) {
+    // Older MSVC runtimes' vsnprintf doesn't return the needed length, but
+    // they have _vscprintf for that.
+    va_list args;
+    va_start(args, fmt);
+#ifdef _MSC_VER
+    int len = _vscprintf(fmt, args);
+#else
+    int len = vsnprintf(NULL, 0, fmt, args);
+#endif
+    va_end(args);
+
+    char *rv = (char *)Alloc(len + 1);
+    va_start(args, fmt);
+    vsprintf(rv, fmt, args);
+    va_end(args);
+    return rv;
+}
+
+
+void Arena::Reset() {
+    if (blocks && blocks->next) {
+        size_t capacity = 0;
+        for (ArenaBlock *block = blocks; block; block = block->next) {
+            capacity += block->capacity;
+        }
+        FreeBlocks(blocks);
+        blocks = NewBlock(capacity, NULL);
+    }
+    if (blocks) {
+        blocks->used = 0;
+    }
+}
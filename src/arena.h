@@ -0,0 +1,40 @@
+#pragma once
+
+#include "windows_fnt.h"
+
+#include <stddef.h>
+
+
+// A bump allocator for everything a conversion needs while it runs: the
+// parsed fonts, glyph sheets, scratch rows and path strings. Nothing is
+// freed on its own. Reset() frees the lot in one go, and keeps enough memory
+// for the next conversion to need no more mallocs, so one Arena per thread
+// keeps a batch run's memory flat. Not thread safe.
+struct ArenaBlock;
+
+struct Arena {
+    ArenaBlock *blocks;             // Newest first.
+
+    Arena();
+    ~Arena();
+
+    // Returns num_bytes of uninitialised memory, 16 byte aligned.
+    void *Alloc(size_t num_bytes);
+
+    // Returns count zeroed Ts. Only for types that are valid zeroed and need
+    // no destructor.
+    template <class T>
+    T *New(size_t count = 1) {
+        return (T *)AllocZeroed(count * sizeof(T));
+    }
+
+    void *AllocZeroed(size_t num_bytes);
+
+    // Like sprintf, into a string allocated from the arena.
+    char *Printf(const char *fmt, ...);
+
+    // Frees everything allocated since the last Reset(). If that took more
+    // than one block, they are swapped for a single block big enough for
+    // all of it.
+    void Reset();
+};
@@ -0,0 +1,210 @@
+#include "batch.h"
+
+#include "converter.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <ctype.h>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+
+bool HasFonExtension(const char *name) {
+    size_t len = strlen(name);
+    if (len < 4) {
+        return false;
+    }
+    const char *ext = name + len - 4;
+    return ext[0] == '.' && tolower(ext[1]) == 'f' && tolower(ext[2]) == 'o' && tolower(ext[3]) == 'n';
+}
+
+
+void PrintWarnings(const char *path, ConvertContext const &ctx) {
+    for (unsigned i = 0; i < ctx.warnings.size(); i++) {
+        fprintf(stderr, "%s: Warning: %s\n", path, ctx.warnings[i].c_str());
+    }
+}
+
+
+#ifdef _WIN32
+
+bool CollectInputs(const char *path, std::vector<std::string> *inputs) {
+    DWORD attribs = GetFileAttributesA(path);
+    if (attribs == INVALID_FILE_ATTRIBUTES) {
+        return false;
+    }
+
+    if (!(attribs & FILE_ATTRIBUTE_DIRECTORY)) {
+        inputs->push_back(path);
+        return true;
+    }
+
+    std::string pattern = std::string(path) + "/*";
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA(pattern.c_str(), &find_data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return true;
+    }
+
+    do {
+        const char *name = find_data.cFileName;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        // Directory links and junctions are skipped, as they can loop.
+        std::string child = std::string(path) + "/" + name;
+        DWORD child_attribs = find_data.dwFileAttributes;
+        if (child_attribs & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!(child_attribs & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                CollectInputs(child.c_str(), inputs);
+            }
+        }
+        else if (HasFonExtension(name)) {
+            inputs->push_back(child);
+        }
+    } while (FindNextFileA(find, &find_data));
+
+    FindClose(find);
+    return true;
+}
+
+#else
+
+bool CollectInputs(const char *path, std::vector<std::string> *inputs) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        inputs->push_back(path);
+        return true;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return true;
+    }
+
+    while (struct dirent *entry = readdir(dir)) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        // Links to files are followed, but links to directories are
+        // skipped, as they can loop.
+        std::string child = std::string(path) + "/" + name;
+        if (lstat(child.c_str(), &st) != 0) {
+            continue;
+        }
+        bool is_link = S_ISLNK(st.st_mode);
+        if (is_link && stat(child.c_str(), &st) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!is_link) {
+                CollectInputs(child.c_str(), inputs);
+            }
+        }
+        else if (HasFonExtension(name)) {
+            inputs->push_back(child);
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+#endif
+
+
+// Finds the inputs whose outputs would have the same names as another
+// input's, eg a/font.fon and b/font.fon, which would overwrite each other in
+// out_dir. Sets clashes[i] to the first other input with input i's name, or
+// -1 if there isn't one.
+static void FindOutputClashes(std::vector<std::string> const &inputs, std::vector<int> *clashes) {
+    Arena arena;
+    std::map<std::string, int> first_with_name;
+    std::vector<std::string> names(inputs.size());
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        names[i] = GetNameFromPath(inputs[i].c_str(), &arena);
+#ifdef _WIN32
+        // The file system ignores case.
+        for (unsigned j = 0; j < names[i].size(); j++) {
+            names[i][j] = tolower(names[i][j]);
+        }
+#endif
+        if (!first_with_name.count(names[i])) {
+            first_with_name[names[i]] = i;
+        }
+    }
+
+    clashes->assign(inputs.size(), -1);
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        int first = first_with_name[names[i]];
+        if (first != (int)i) {
+            (*clashes)[i] = first;
+            (*clashes)[first] = i;
+        }
+    }
+}
+
+
+int RunBatch(std::vector<std::string> const &inputs, ConvertOptions const &opts, int num_threads,
+             ConvertMetrics *metrics) {
+    std::atomic<int> num_failed(0);
+
+    // None of the inputs that clash are converted, as which one's outputs
+    // should win isn't clear.
+    std::vector<int> clashes;
+    FindOutputClashes(inputs, &clashes);
+
+    {
+        ThreadPool pool(num_threads);
+        std::vector<ConvertContext> contexts(pool.NumThreads());
+        std::vector<ConvertMetrics> worker_metrics(metrics ? pool.NumThreads() : 0);
+        for (unsigned i = 0; i < contexts.size(); i++) {
+            contexts[i].pool = &pool;
+            contexts[i].worker_index = i;
+            if (metrics) {
+                contexts[i].metrics = &worker_metrics[i];
+            }
+        }
+        for (unsigned i = 0; i < inputs.size(); i++) {
+            const char *path = inputs[i].c_str();
+            if (clashes[i] >= 0) {
+                fprintf(stderr, "%s: Outputs would have the same names as those of '%s'\n", path,
+                    inputs[clashes[i]].c_str());
+                num_failed++;
+                continue;
+            }
+            pool.Push([path, &opts, &contexts, &num_failed](int worker_index) {
+                ConvertError err;
+                if (!ConvertFile(path, opts, &contexts[worker_index], &err)) {
+                    fprintf(stderr, "%s: %s\n", path, err.msg);
+                    num_failed++;
+                }
+                PrintWarnings(path, contexts[worker_index]);
+            });
+        }
+        pool.Wait();
+
+        for (unsigned i = 0; i < worker_metrics.size(); i++) {
+            metrics->Merge(worker_metrics[i]);
+        }
+    }
+
+    return num_failed;
+}
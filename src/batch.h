@@ -0,0 +1,26 @@
+#pragma once
+
+#include "converter.h"
+
+#include <string>
+#include <vector>
+
+
+// True if name ends in .fon, in any case.
+bool HasFonExtension(const char *name);
+
+// Prints the warnings ctx's last conversion left, each prefixed with path.
+void PrintWarnings(const char *path, ConvertContext const &ctx);
+
+// Adds path to inputs if it is a file, or every .fon file below it if it is
+// a directory. Links to directories below path aren't followed. Returns
+// false if path doesn't exist.
+bool CollectInputs(const char *path, std::vector<std::string> *inputs);
+
+// Converts every input on a pool of num_threads workers (<= 0 means all
+// cores). Failures are reported on stderr and don't stop the other inputs.
+// Inputs in different directories with the same name would write the same
+// outputs, so they all fail instead. Returns the number of inputs that failed. If metrics isn't NULL, every
+// worker's stage times and counts are merged into it.
+int RunBatch(std::vector<std::string> const &inputs, ConvertOptions const &opts, int num_threads,
+             ConvertMetrics *metrics);
@@ -0,0 +1,279 @@
+#include "benchmark.h"
+
+#include "dfbf_decoder.h"
+#include "output_writer.h"
+#include "synth_fon.h"
+
+#include "df_time.h"
+
+#include <stdio.h>
+
+
+// How long to spend decoding each variant of each input.
+static const double DECODE_SECONDS = 0.25;
+
+
+struct DecodeResult {
+    int num_bytes;                  // Total size of the font blobs.
+    double decoded_bytes;           // Size of the 1 bit per pixel sheets decoded.
+    double seconds;
+};
+
+
+// Encodes the fonts of a .fon with opts, then decodes them over and over for
+// DECODE_SECONDS.
+static bool EncodeAndTimeDecode(ByteView file, ConvertOptions const &opts, DecodeResult *result,
+                                ConvertError *err) {
+    Arena arena;
+    FullFnt *fnts[MAX_FNTS_PER_FILE] = { NULL };
+    int num_fnts = 0;
+    bool ok = ParseFon(file, fnts, &num_fnts, &arena, err);
+
+    std::vector<MemBuf> blobs(num_fnts);
+    result->num_bytes = 0;
+    for (int i = 0; i < num_fnts && ok; i++) {
+        WriteDfbfToMemBuf(&blobs[i], fnts[i], opts, &arena, NULL);
+        blobs[i].FlushNibble();
+        result->num_bytes += blobs[i].data_num_bytes;
+    }
+
+    if (!ok) {
+        return false;
+    }
+
+    result->decoded_bytes = 0.0;
+    double start = GetRealTime();
+    do {
+        for (int i = 0; i < num_fnts; i++) {
+            DecodedFont decoded;
+            if (!DecodeDfbfBlob(ByteView(blobs[i].data, blobs[i].data_num_bytes),
+                                opts.dfbf_version, &decoded, err)) {
+                return false;
+            }
+            result->decoded_bytes += decoded.sheet->width * (double)decoded.sheet->height / 8.0;
+        }
+        result->seconds = GetRealTime() - start;
+    } while (result->seconds < DECODE_SECONDS);
+
+    return true;
+}
+
+
+static double MegabytesPerSecond(DecodeResult const &result) {
+    return result.decoded_bytes / result.seconds / (1024.0 * 1024.0);
+}
+
+
+int RunDecodeBenchmark(std::vector<std::string> const &inputs, ConvertOptions const &opts) {
+    ConvertOptions plain_opts = opts;
+    plain_opts.huffman = false;
+    ConvertOptions huffman_opts = opts;
+    huffman_opts.huffman = true;
+
+    printf("%-32s %10s %9s %10s %9s\n", "", "Plain", "MB/s", "Huffman", "MB/s");
+
+    DecodeResult totals[2] = { { 0, 0.0, 0.0 }, { 0, 0.0, 0.0 } };
+    int num_failed = 0;
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        const char *path = inputs[i].c_str();
+        MappedFile file;
+        ConvertError err;
+        DecodeResult plain, huffman;
+        if (!file.Open(path)) {
+            err.Set("Couldn't open file");
+        }
+        else if (EncodeAndTimeDecode(file.view, plain_opts, &plain, &err) &&
+                 EncodeAndTimeDecode(file.view, huffman_opts, &huffman, &err)) {
+            printf("%-32s %10d %9.1f %10d %9.1f\n", path, plain.num_bytes,
+                MegabytesPerSecond(plain), huffman.num_bytes, MegabytesPerSecond(huffman));
+
+            DecodeResult *results[2] = { &plain, &huffman };
+            for (int j = 0; j < 2; j++) {
+                totals[j].num_bytes += results[j]->num_bytes;
+                totals[j].decoded_bytes += results[j]->decoded_bytes;
+                totals[j].seconds += results[j]->seconds;
+            }
+            continue;
+        }
+
+        fprintf(stderr, "%s: %s\n", path, err.msg);
+        num_failed++;
+    }
+
+    if (totals[0].seconds > 0.0) {
+        printf("%-32s %10d %9.1f %10d %9.1f\n", "Total", totals[0].num_bytes,
+            MegabytesPerSecond(totals[0]), totals[1].num_bytes, MegabytesPerSecond(totals[1]));
+    }
+
+    return num_failed;
+}
+
+
+// How long to spend on each scenario, in each of the two passes. Every pass
+// runs at least BENCH_MIN_ITERATIONS times, and the fastest iteration is
+// reported, as that is the one least disturbed by the rest of the machine.
+static const double BENCH_SECONDS = 0.5;
+static const int BENCH_MIN_ITERATIONS = 5;
+
+
+struct BenchScenario {
+    const char *name;
+    SynthFonParams params;
+};
+
+
+static BenchScenario MakeScenario(const char *name, int num_sizes, int min_height, int max_height,
+                                  int last_char, bool proportional, int pattern) {
+    BenchScenario scenario;
+    scenario.name = name;
+    scenario.params.num_sizes = num_sizes;
+    scenario.params.min_height = min_height;
+    scenario.params.max_height = max_height;
+    scenario.params.last_char = last_char;
+    scenario.params.proportional = proportional;
+    scenario.params.pattern = pattern;
+    return scenario;
+}
+
+
+// The fixed suite. Changing it changes every number, so add new scenarios at
+// the end.
+static void GetBenchScenarios(std::vector<BenchScenario> *scenarios) {
+    scenarios->push_back(MakeScenario("fixed_13", 1, 13, 13, 0xff, false, SYNTH_RANDOM));
+    scenarios->push_back(MakeScenario("proportional_13", 1, 13, 13, 0xff, true, SYNTH_RANDOM));
+    scenarios->push_back(MakeScenario("64_glyphs", 1, 13, 13, 0x5f, false, SYNTH_RANDOM));
+    scenarios->push_back(MakeScenario("16_sizes_8_to_48", 16, 8, 48, 0xff, true, SYNTH_SHAPES));
+    scenarios->push_back(MakeScenario("tall_96", 1, 96, 96, 0xff, false, SYNTH_SHAPES));
+    scenarios->push_back(MakeScenario("checker_16", 1, 16, 16, 0xff, false, SYNTH_CHECKER));
+    scenarios->push_back(MakeScenario("sparse_4_sizes", 4, 16, 64, 0xff, false, SYNTH_SPARSE));
+    scenarios->push_back(MakeScenario("64_sizes_8_to_40", 64, 8, 40, 0xff, false, SYNTH_RANDOM));
+
+    BenchScenario fnt3 = MakeScenario("fnt3_tall_200", 1, 200, 200, 0xff, true, SYNTH_SHAPES);
+    fnt3.params.fnt_version = 0x300;
+    scenarios->push_back(fnt3);
+}
+
+
+// Fastest end to end time of ConvertFonBuffer(), which does the whole
+// conversion in memory so that the numbers don't depend on the file system,
+// and the fastest time of each stage in a second pass with the stage timers
+// on. The timers cost a little, so they are
+// kept out of the end to end time.
+static bool TimeScenario(ByteView file, ConvertOptions const &opts, ConvertContext *ctx,
+                         double *best_seconds, double *best_stage_seconds, ConvertError *err) {
+    ConvertResult result;
+    *best_seconds = 1e30;
+    double start = GetRealTime();
+    for (int i = 0; i < BENCH_MIN_ITERATIONS || GetRealTime() - start < BENCH_SECONDS; i++) {
+        double iteration_start = GetRealTime();
+        if (!ConvertFonBuffer(file.data, file.num_bytes, "synth", opts, ctx, &result, err)) {
+            return false;
+        }
+        double seconds = GetRealTime() - iteration_start;
+        if (seconds < *best_seconds) {
+            *best_seconds = seconds;
+        }
+    }
+
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        best_stage_seconds[stage] = 1e30;
+    }
+    ConvertMetrics metrics;
+    ctx->metrics = &metrics;
+    start = GetRealTime();
+    bool ok = true;
+    for (int i = 0; ok && (i < BENCH_MIN_ITERATIONS || GetRealTime() - start < BENCH_SECONDS); i++) {
+        metrics.Reset();
+        ok = ConvertFonBuffer(file.data, file.num_bytes, "synth", opts, ctx, &result, err);
+        for (int stage = 0; stage < NUM_STAGES; stage++) {
+            if (metrics.stage_seconds[stage] < best_stage_seconds[stage]) {
+                best_stage_seconds[stage] = metrics.stage_seconds[stage];
+            }
+        }
+    }
+    ctx->metrics = NULL;
+
+    return ok;
+}
+
+
+int RunBenchmark(ConvertOptions const &opts) {
+    std::vector<BenchScenario> scenarios;
+    GetBenchScenarios(&scenarios);
+
+    // Stages that only ConvertFile() runs are left out.
+    int stages[NUM_STAGES];
+    int num_stages = 0;
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        if (stage != STAGE_CACHE && stage != STAGE_WRITE) {
+            stages[num_stages++] = stage;
+        }
+    }
+
+    printf("%-18s %5s %6s %8s %8s %11s %8s\n", "End to end", "Sizes", "Glyphs", "In KB", "Out KB",
+        "Glyphs/s", "MB/s");
+
+    std::vector<double> stage_ns_per_glyph(scenarios.size() * NUM_STAGES);
+    ConvertContext ctx;
+    MemBuf fon;
+    int num_failed = 0;
+    for (unsigned i = 0; i < scenarios.size(); i++) {
+        BenchScenario const &scenario = scenarios[i];
+        MakeSynthFon(&fon, scenario.params);
+        ByteView file(fon.data, fon.data_num_bytes);
+
+        double seconds;
+        double stage_seconds[NUM_STAGES];
+        ConvertError err;
+        if (!TimeScenario(file, opts, &ctx, &seconds, stage_seconds, &err)) {
+            fprintf(stderr, "%s: %s\n", scenario.name, err.msg);
+            num_failed++;
+            continue;
+        }
+
+        int num_chars = scenario.params.last_char - scenario.params.first_char + 1;
+        int num_glyphs = scenario.params.num_sizes * num_chars;
+        printf("%-18s %5d %6d %8.1f %8.1f %11.0f %8.1f\n", scenario.name, scenario.params.num_sizes,
+            num_glyphs, fon.data_num_bytes / 1024.0, ctx.dfbf.data_num_bytes / 1024.0,
+            num_glyphs / seconds, fon.data_num_bytes / seconds / (1024.0 * 1024.0));
+
+        for (int stage = 0; stage < NUM_STAGES; stage++) {
+            stage_ns_per_glyph[i * NUM_STAGES + stage] = stage_seconds[stage] * 1e9 / num_glyphs;
+        }
+    }
+
+    printf("\n%-18s", "ns per glyph");
+    for (int j = 0; j < num_stages; j++) {
+        printf(" %9s", GetStageName(stages[j]));
+    }
+    printf("\n");
+    for (unsigned i = 0; i < scenarios.size(); i++) {
+        printf("%-18s", scenarios[i].name);
+        for (int j = 0; j < num_stages; j++) {
+            printf(" %9.1f", stage_ns_per_glyph[i * NUM_STAGES + stages[j]]);
+        }
+        printf("\n");
+    }
+
+    return num_failed;
+}
+
+
+int WriteBenchFons(const char *out_dir) {
+    std::vector<BenchScenario> scenarios;
+    GetBenchScenarios(&scenarios);
+
+    MemBuf fon;
+    int num_failed = 0;
+    for (unsigned i = 0; i < scenarios.size(); i++) {
+        MakeSynthFon(&fon, scenarios[i].params);
+        std::string path = std::string(out_dir) + "/" + scenarios[i].name + ".fon";
+        ConvertError err;
+        if (!WriteArtifact(path.c_str(), &fon, false, &err)) {
+            fprintf(stderr, "%s\n", err.msg);
+            num_failed++;
+        }
+    }
+
+    return num_failed;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "converter.h"
+
+#include <string>
+#include <vector>
+
+
+// Encodes every font of each input with and without the Huffman stage, and
+// times decoding both, to show what the smaller output costs in load speed.
+// Prints a line per input and a total. Returns the number of inputs that
+// couldn't be read.
+int RunDecodeBenchmark(std::vector<std::string> const &inputs, ConvertOptions const &opts);
+
+// Converts a fixed suite of synthetic fonts, see synth_fon.h, entirely in
+// memory with opts. Prints the fastest end to end time of each as glyphs
+// and .fon megabytes per second, then the time of each stage per glyph.
+// The suite and its seeds never change, so runs before and after a change
+// to the converter can be compared directly. Returns the number of
+// scenarios that failed.
+int RunBenchmark(ConvertOptions const &opts);
+
+// Writes the suite's .fon files to out_dir, so that they can be converted,
+// profiled or looked at in the preview like any other input. Returns the
+// number that couldn't be written.
+int WriteBenchFons(const char *out_dir);
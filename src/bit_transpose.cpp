@@ -0,0 +1,256 @@
+#include "bit_transpose.h"
+
+#include <atomic>
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define HAVE_X86_SIMD 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+
+void TransposeColumnsScalar(u8 *out, int out_stride, const u8 *const *columns,
+                            int num_columns, int num_rows, const u8 *src_end) {
+    // Only the SIMD kernels read past the end of a column, so only they need
+    // src_end. The columns were bounds checked when the font was parsed.
+    (void)src_end;
+    for (int k = 0; k < num_columns; k++) {
+        const u8 *column = columns[k];
+        for (int y = 0; y < num_rows; y++) {
+            out[y * out_stride + k] = ReverseBits(column[y]);
+        }
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+// Loads 16 bytes from p, or as many as there are before src_end.
+TARGET_SSE2
+static __m128i LoadColumn16(const u8 *p, const u8 *src_end) {
+    if (src_end - p >= 16) {
+        return _mm_loadu_si128((const __m128i *)p);
+    }
+
+    u8 tmp[16] = { 0 };
+    if (src_end > p) {
+        memcpy(tmp, p, src_end - p);
+    }
+    return _mm_loadu_si128((const __m128i *)tmp);
+}
+
+
+// Transposes a 16x16 byte matrix. Four rounds of interleaving rows i and
+// i + 8 each rotate one bit of the row index into the column index, so after
+// four rounds they have swapped.
+TARGET_SSE2
+static void Transpose16x16(__m128i *v) {
+    __m128i tmp[16];
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8; i++) {
+            tmp[i * 2] = _mm_unpacklo_epi8(v[i], v[i + 8]);
+            tmp[i * 2 + 1] = _mm_unpackhi_epi8(v[i], v[i + 8]);
+        }
+        memcpy(v, tmp, sizeof(tmp));
+    }
+}
+
+
+TARGET_SSE2
+static __m128i ReverseBits16(__m128i x) {
+    // There are no 8-bit shifts, so shift 16-bit lanes and mask off the bits
+    // that crossed into the neighbouring byte.
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 1), m1), _mm_slli_epi16(_mm_and_si128(x, m1), 1));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 2), m2), _mm_slli_epi16(_mm_and_si128(x, m2), 2));
+    x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 4), m4), _mm_slli_epi16(_mm_and_si128(x, m4), 4));
+    return x;
+}
+
+
+// Handles columns[k0..k0+16) and rows [y, y + 16). Only rows before num_rows
+// are stored.
+TARGET_SSE2
+static void TransposeBlockSse2(u8 *out, int out_stride, const u8 *const *columns, int k0,
+                               int num_columns, int y, int num_rows, const u8 *src_end) {
+    __m128i v[16];
+    for (int i = 0; i < 16; i++) {
+        if (k0 + i < num_columns) {
+            v[i] = LoadColumn16(columns[k0 + i] + y, src_end);
+        }
+        else {
+            v[i] = _mm_setzero_si128();
+        }
+    }
+
+    Transpose16x16(v);
+
+    int rows_to_store = num_rows - y < 16 ? num_rows - y : 16;
+    for (int i = 0; i < rows_to_store; i++) {
+        _mm_storeu_si128((__m128i *)(out + (y + i) * out_stride + k0), ReverseBits16(v[i]));
+    }
+}
+
+
+void TransposeColumnsSse2(u8 *out, int out_stride, const u8 *const *columns,
+                          int num_columns, int num_rows, const u8 *src_end) {
+    for (int k0 = 0; k0 < num_columns; k0 += 16) {
+        for (int y = 0; y < num_rows; y += 16) {
+            TransposeBlockSse2(out, out_stride, columns, k0, num_columns, y, num_rows, src_end);
+        }
+    }
+}
+
+
+// Same as the SSE2 version, but each 256-bit register holds rows [y, y+16)
+// in its low lane and [y+16, y+32) in its high lane. The unpack instructions
+// work within lanes, so that is two independent 16x16 transposes at once.
+TARGET_AVX2
+static void TransposeBlockAvx2(u8 *out, int out_stride, const u8 *const *columns, int k0,
+                               int num_columns, int y, int num_rows, const u8 *src_end) {
+    __m256i v[16];
+    for (int i = 0; i < 16; i++) {
+        if (k0 + i < num_columns) {
+            const u8 *p = columns[k0 + i] + y;
+            __m128i lo = LoadColumn16(p, src_end);
+            __m128i hi = LoadColumn16(p + 16, src_end);
+            v[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        }
+        else {
+            v[i] = _mm256_setzero_si256();
+        }
+    }
+
+    __m256i tmp[16];
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 8; i++) {
+            tmp[i * 2] = _mm256_unpacklo_epi8(v[i], v[i + 8]);
+            tmp[i * 2 + 1] = _mm256_unpackhi_epi8(v[i], v[i + 8]);
+        }
+        memcpy(v, tmp, sizeof(tmp));
+    }
+
+    // Reverse the bits of each byte by looking up each nibble.
+    const __m256i reverse_nibble = _mm256_setr_epi8(
+        0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf,
+        0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+
+    int rows_to_store = num_rows - y < 32 ? num_rows - y : 32;
+    for (int i = 0; i < 16; i++) {
+        __m256i lo = _mm256_and_si256(v[i], low_nibbles);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v[i], 4), low_nibbles);
+        __m256i reversed = _mm256_or_si256(
+            _mm256_slli_epi16(_mm256_shuffle_epi8(reverse_nibble, lo), 4),
+            _mm256_shuffle_epi8(reverse_nibble, hi));
+
+        if (i < rows_to_store) {
+            _mm_storeu_si128((__m128i *)(out + (y + i) * out_stride + k0),
+                _mm256_castsi256_si128(reversed));
+        }
+        if (i + 16 < rows_to_store) {
+            _mm_storeu_si128((__m128i *)(out + (y + i + 16) * out_stride + k0),
+                _mm256_extracti128_si256(reversed, 1));
+        }
+    }
+}
+
+
+void TransposeColumnsAvx2(u8 *out, int out_stride, const u8 *const *columns,
+                          int num_columns, int num_rows, const u8 *src_end) {
+    for (int k0 = 0; k0 < num_columns; k0 += 16) {
+        int y = 0;
+        for (; num_rows - y > 16; y += 32) {
+            TransposeBlockAvx2(out, out_stride, columns, k0, num_columns, y, num_rows, src_end);
+        }
+        if (y < num_rows) {
+            TransposeBlockSse2(out, out_stride, columns, k0, num_columns, y, num_rows, src_end);
+        }
+    }
+}
+
+
+static bool CpuHasSse2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] >> 26) & 1;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+
+static bool CpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+
+    // The OS must save the YMM registers on context switches too.
+    __cpuid(info, 1);
+    bool os_saves_ymm = ((info[2] >> 27) & 1) && (_xgetbv(0) & 6) == 6;
+    if (!os_saves_ymm) {
+        return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+void TransposeColumnsSse2(u8 *out, int out_stride, const u8 *const *columns,
+                          int num_columns, int num_rows, const u8 *src_end) {
+    TransposeColumnsScalar(out, out_stride, columns, num_columns, num_rows, src_end);
+}
+
+
+void TransposeColumnsAvx2(u8 *out, int out_stride, const u8 *const *columns,
+                          int num_columns, int num_rows, const u8 *src_end) {
+    TransposeColumnsScalar(out, out_stride, columns, num_columns, num_rows, src_end);
+}
+
+#endif
+
+
+// Racing threads all compute the same answer, so there's no need to lock.
+// It is atomic only so that the racing reads and writes are well defined.
+static std::atomic<TransposeKernel *> s_kernel;
+
+
+TransposeKernel *GetTransposeKernel() {
+    TransposeKernel *kernel = s_kernel.load(std::memory_order_relaxed);
+    if (!kernel) {
+        kernel = TransposeColumnsScalar;
+#ifdef HAVE_X86_SIMD
+        if (CpuHasAvx2()) {
+            kernel = TransposeColumnsAvx2;
+        }
+        else if (CpuHasSse2()) {
+            kernel = TransposeColumnsSse2;
+        }
+#endif
+        s_kernel.store(kernel, std::memory_order_relaxed);
+    }
+    return kernel;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "windows_fnt.h"
+
+
+// Reverses the order of the bits in a byte.
+inline u8 ReverseBits(u8 b) {
+    return (u8)((((b * 0x80200802ULL) & 0x0884422110ULL) * 0x0101010101ULL) >> 32);
+}
+
+
+// FNT glyph bitmaps are stored as columns 8 pixels wide, one byte per row,
+// with the most significant bit leftmost. A transpose kernel turns
+// num_columns of these into row-major bytes with the leftmost pixel in the
+// least significant bit, ready to OR into a GlyphSheet:
+//
+//     out[y * out_stride + k] = ReverseBits(columns[k][y])
+//
+// out_stride must be at least num_columns rounded up to a multiple of 16,
+// because the SIMD kernels store 16 bytes at a time. The kernels may read
+// up to 31 bytes past the end of a column, but never at or past src_end.
+typedef void TransposeKernel(u8 *out, int out_stride, const u8 *const *columns,
+                             int num_columns, int num_rows, const u8 *src_end);
+
+void TransposeColumnsScalar(u8 *out, int out_stride, const u8 *const *columns,
+                            int num_columns, int num_rows, const u8 *src_end);
+void TransposeColumnsSse2(u8 *out, int out_stride, const u8 *const *columns,
+                          int num_columns, int num_rows, const u8 *src_end);
+void TransposeColumnsAvx2(u8 *out, int out_stride, const u8 *const *columns,
+                          int num_columns, int num_rows, const u8 *src_end);
+
+// The fastest kernel the CPU supports. Chosen once, on first call.
+TransposeKernel *GetTransposeKernel();
@@ -0,0 +1,151 @@
+#include "cache.h"
+#include "output_writer.h"
+
+#include <string.h>
+
+
+// A simple multiply-rotate hash that eats 8 bytes per step. This runs over
+// every byte of every input on each cached run, so it needs to be much
+// faster than the conversion it saves, but it doesn't need to be strong.
+struct CacheHasher {
+    u64 h;
+
+    CacheHasher() {
+        h = 0x6a09e667f3bcc908ULL;
+    }
+
+    void MixWord(u64 v) {
+        h ^= v * 0x9e3779b97f4a7c15ULL;
+        h = (h << 31 | h >> 33) * 0xc2b2ae3d27d4eb4fULL;
+    }
+
+    void MixBytes(const void *data, size_t num_bytes) {
+        const u8 *src = (const u8 *)data;
+        MixWord(num_bytes);
+        while (num_bytes >= 8) {
+            u64 v;
+            memcpy(&v, src, 8);
+            MixWord(v);
+            src += 8;
+            num_bytes -= 8;
+        }
+
+        u64 tail = 0;
+        memcpy(&tail, src, num_bytes);
+        MixWord(tail);
+    }
+
+    u64 Finish() {
+        u64 x = h;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return x;
+    }
+};
+
+
+u64 ComputeCacheKey(FullFnt *const *fnts, int num_fnts, const char *fnt_name,
+                    ConvertOptions const &opts) {
+    CacheHasher hasher;
+    hasher.MixWord(CACHE_FORMAT_VERSION);
+
+    // Only the options that change the contents of the outputs.
+    hasher.MixWord(opts.dfbf_version);
+    hasher.MixWord(opts.codec);
+    hasher.MixWord(opts.huffman);
+    hasher.MixWord(opts.packing);
+    hasher.MixWord(opts.c_data);
+    hasher.MixBytes(opts.c_decoded, sizeof(opts.c_decoded));
+
+    // The name appears in the .cpp and .h.
+    hasher.MixBytes(fnt_name, strlen(fnt_name));
+
+    hasher.MixWord(num_fnts);
+    for (int i = 0; i < num_fnts; i++) {
+        hasher.MixBytes(fnts[i]->resource.data, fnts[i]->resource.num_bytes);
+    }
+
+    return hasher.Finish();
+}
+
+
+u64 ComputeFontKey(FullFnt *fnt, ConvertOptions const &opts) {
+    CacheHasher hasher;
+    hasher.MixWord(CACHE_FORMAT_VERSION);
+    hasher.MixWord(opts.dfbf_version);
+    hasher.MixWord(opts.codec);
+    hasher.MixWord(opts.huffman);
+    hasher.MixWord(opts.packing);
+    hasher.MixBytes(fnt->resource.data, fnt->resource.num_bytes);
+    return hasher.Finish();
+}
+
+
+// Returns "<cache_dir>/<key in hex><extension>".
+static char *MakeEntryPath(const char *cache_dir, u64 key, const char *extension, Arena *arena) {
+    return arena->Printf("%s/%08x%08x%s", cache_dir, (unsigned)(key >> 32), (unsigned)key, extension);
+}
+
+
+bool ReadCacheEntry(const char *cache_dir, u64 key, const char *extension, MemBuf *buf,
+                    Arena *arena) {
+    char *path = MakeEntryPath(cache_dir, key, extension, arena);
+    MappedFile entry;
+    bool found = entry.Open(path);
+    if (!found) {
+        return false;
+    }
+
+    const u32 *version = entry.view.Get<u32>(0);
+    if (!version || *version != CACHE_FORMAT_VERSION) {
+        return false;
+    }
+
+    buf->PushBytes(entry.view.data + sizeof(u32), (int)(entry.view.num_bytes - sizeof(u32)));
+    return true;
+}
+
+
+void WriteCacheEntry(const char *cache_dir, u64 key, const char *extension, const MemBuf *buf,
+                     Arena *arena) {
+    char *path = MakeEntryPath(cache_dir, key, extension, arena);
+    MemBuf entry;
+    u32 version = CACHE_FORMAT_VERSION;
+    entry.PushBytes(&version, sizeof(version));
+    entry.PushBytes(buf->data, buf->data_num_bytes);
+    ConvertError err;
+    ReplaceArtifact(path, &entry, false, &err);
+}
+
+
+bool FontBlobCache::Find(u64 key, MemBuf *buf) {
+    std::map<u64, Entry>::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    it->second.used = true;
+    buf->PushBytes(&it->second.blob[0], (int)it->second.blob.size());
+    return true;
+}
+
+
+void FontBlobCache::Store(u64 key, const MemBuf *blob) {
+    Entry *entry = &entries[key];
+    entry->blob.assign(blob->data, blob->data + blob->data_num_bytes);
+    entry->used = true;
+}
+
+
+void FontBlobCache::PruneUnused() {
+    std::map<u64, Entry>::iterator it = entries.begin();
+    while (it != entries.end()) {
+        if (it->second.used) {
+            it->second.used = false;
+            ++it;
+        }
+        else {
+            entries.erase(it++);
+        }
+    }
+}
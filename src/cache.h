@@ -0,0 +1,62 @@
+#pragma once
+
+#include "converter.h"
+
+#include <map>
+#include <vector>
+
+
+// A directory of outputs from earlier conversions. Each entry is named after
+// a hash of everything its output depends on: the raw FONT resources of the
+// .fon, the output options, the font name and CACHE_FORMAT_VERSION. So a
+// .fon that has only been touched or moved, or that has the same fonts as
+// one already converted, doesn't need encoding again.
+
+// Bump this whenever a change to the encoder or output writer changes the
+// output for the same input and options, so that stale entries are ignored.
+// It is both part of the key and stored at the start of each entry.
+//   2: FNT 3.0 support. Glyph bitmap offsets are from the resource start,
+//      and cells are by char code, so fonts that don't start at char 32
+//      convert differently.
+//   3: --c-data string stores blobs in aligned char arrays, not unions.
+enum { CACHE_FORMAT_VERSION = 3 };
+
+u64 ComputeCacheKey(FullFnt *const *fnts, int num_fnts, const char *fnt_name,
+                    ConvertOptions const &opts);
+
+// Appends the cached <key><extension> to buf. Returns false if there isn't one,
+// or if it was written with another CACHE_FORMAT_VERSION. The paths are
+// allocated from arena.
+bool ReadCacheEntry(const char *cache_dir, u64 key, const char *extension, MemBuf *buf,
+                    Arena *arena);
+
+// Stores buf as <key><extension>. The entry is written under a temporary name
+// and renamed into place, so that a concurrent reader never sees half of it.
+// Failures are ignored, as they only cost a conversion next time.
+void WriteCacheEntry(const char *cache_dir, u64 key, const char *extension, const MemBuf *buf,
+                     Arena *arena);
+
+
+// Hash of everything one font's blob depends on: its FONT resource and the
+// encoding options.
+u64 ComputeFontKey(FullFnt *fnt, ConvertOptions const &opts);
+
+// Encoded font blobs kept in memory, keyed on ComputeFontKey(), so that a
+// .fon converted again only re-encodes the fonts that changed. Used by watch
+// mode, with one per file. Not thread safe.
+struct FontBlobCache {
+    struct Entry {
+        std::vector<u8> blob;
+        bool used;                  // Found or stored since the last PruneUnused().
+    };
+
+    std::map<u64, Entry> entries;
+
+    // Appends the blob to buf. Returns false if there isn't one.
+    bool Find(u64 key, MemBuf *buf);
+    void Store(u64 key, const MemBuf *blob);
+
+    // Drops the entries that haven't been used since the last call, which
+    // are the fonts a file no longer has after an edit.
+    void PruneUnused();
+};
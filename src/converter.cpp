@@ -0,0 +1,1526 @@
+#include "converter.h"
+#include "arena.h"
+#include "bit_transpose.h"
+#include "cache.h"
+#include "dfbf_decoder.h"
+#include "glyph_sheet.h"
+#include "huffman.h"
+#include "mem_buf.h"
+#include "output_writer.h"
+#include "predictor.h"
+#include "thread_pool.h"
+
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+bool ConvertError::Set(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+    msg[sizeof(msg) - 1] = '\0';
+    return false;
+}
+
+
+// FNT resource format explanation https://jeffpar.github.io/kbarchive/kb/065/Q65123/
+static FullFnt *ReadFntResourceItem(ByteView file, const ResourceTableItem *rt_item, int block_size,
+                                    Arena *arena, ConvertError *err) {  
+    if (!(rt_item->resource_id & 0x8000)) {
+        err->Set("Bad resource id");
+        return NULL;
+    }
+    
+    size_t fnt_data_offset = (size_t)block_size * rt_item->data_offset;
+    ByteView fnt_data = file.Sub(fnt_data_offset, file.num_bytes - fnt_data_offset);
+    
+    const FntHeader *fnt = fnt_data.Get<FntHeader>(0);
+    if (!fnt) {
+        err->Set("FNT header at 0x%x is past the end of the file", (int)fnt_data_offset);
+        return NULL;
+    }
+
+    bool is_fnt3 = fnt->version == 0x300;
+    if (fnt->version != 0x200 && !is_fnt3) {
+        err->Set("Version 0x%x found. Only versions 0x200 and 0x300 supported.", fnt->version);
+        return NULL;
+    }
+
+    size_t hdr_num_bytes = sizeof(FntHeader);
+    if (is_fnt3) {
+        const FntHeader3 *hdr3 = fnt_data.Get<FntHeader3>(0);
+        if (!hdr3) {
+            err->Set("FNT 3.0 header at 0x%x is past the end of the file", (int)fnt_data_offset);
+            return NULL;
+        }
+        if (hdr3->flags & (FNT3_FLAG_16_COLOUR | FNT3_FLAG_256_COLOUR | FNT3_FLAG_RGB_COLOUR)) {
+            err->Set("Colour fonts aren't supported (flags 0x%x)", hdr3->flags);
+            return NULL;
+        }
+        if (hdr3->flags & (FNT3_FLAG_ABC_FIXED | FNT3_FLAG_ABC_PROPORTIONAL)) {
+            err->Set("ABC spaced fonts aren't supported (flags 0x%x)", hdr3->flags);
+            return NULL;
+        }
+        hdr_num_bytes = sizeof(FntHeader3);
+    }
+
+    // The .dfbf stores these as bytes.
+    if (fnt->max_width > 255 || fnt->pix_height > 255) {
+        err->Set("Glyphs are %dx%d. At most 255x255 supported.", fnt->max_width, fnt->pix_height);
+        return NULL;
+    }
+    if (fnt->pix_height == 0) {
+        err->Set("Glyphs have zero height");
+        return NULL;
+    }
+    if (fnt->first_char > fnt->last_char) {
+        err->Set("First char %d is after last char %d", fnt->first_char, fnt->last_char);
+        return NULL;
+    }
+
+    // Get the glyph table. It has an extra entry after last_char.
+    const int glyph_table_size = fnt->last_char - fnt->first_char + 2;
+    size_t glyph_entry_num_bytes = is_fnt3 ? sizeof(_Glyph3) : sizeof(_Glyph);
+    const _Glyph *glyph_table = NULL;
+    const _Glyph3 *glyph_table3 = NULL;
+    if (is_fnt3) {
+        glyph_table3 = fnt_data.Get<_Glyph3>(hdr_num_bytes, glyph_table_size);
+    }
+    else {
+        glyph_table = fnt_data.Get<_Glyph>(hdr_num_bytes, glyph_table_size);
+    }
+    if (!glyph_table && !glyph_table3) {
+        err->Set("Glyph table is past the end of the file");
+        return NULL;
+    }
+
+    // Gather the entries of the chars the .dfbf has cells for, which are 32
+    // to 255, into one table for both versions. Chars below 32 are dropped,
+    // which AddDroppedCharWarnings() reports, and the cells of chars the
+    // font doesn't have are left empty.
+    FntGlyph *glyphs = arena->New<FntGlyph>(224);
+    for (int ch = fnt->first_char; ch <= fnt->last_char; ch++) {
+        if (ch < 32) {
+            continue;
+        }
+        FntGlyph *glyph = &glyphs[ch - 32];
+        int i = ch - fnt->first_char;
+        if (is_fnt3) {
+            glyph->pix_width = glyph_table3[i].pix_width;
+            glyph->bitmap_offset = glyph_table3[i].bitmap_offset;
+        }
+        else {
+            glyph->pix_width = glyph_table[i].pix_width;
+            glyph->bitmap_offset = glyph_table[i].bitmap_offset;
+        }
+
+        // The width table stores widths as bytes, and cells are max_width wide.
+        if (glyph->pix_width > fnt->max_width) {
+            err->Set("Char %d is %d pixels wide, wider than the max width of %d", ch, glyph->pix_width,
+                     fnt->max_width);
+            return NULL;
+        }
+    }
+
+    // Check every glyph's bitmap is inside the file before we start drawing.
+    // The resource is trimmed to the size the resource table gives it, or to
+    // the last byte we read if that is further, so that it holds exactly the
+    // bytes the outputs depend on.
+    size_t resource_num_bytes = (size_t)block_size * rt_item->num_bytes;
+    size_t glyph_table_end = hdr_num_bytes + glyph_table_size * glyph_entry_num_bytes;
+    if (resource_num_bytes < glyph_table_end) {
+        resource_num_bytes = glyph_table_end;
+    }
+    for (int c = 0; c < 224; c++) {
+        int num_columns = (glyphs[c].pix_width + 7) / 8;
+        size_t bmp_start = glyphs[c].bitmap_offset;
+        size_t bmp_num_bytes = (size_t)fnt->pix_height * num_columns;
+        if (!fnt_data.Get<u8>(bmp_start, bmp_num_bytes)) {
+            err->Set("Bitmap for char %d is past the end of the file", c + 32);
+            return NULL;
+        }
+        if (resource_num_bytes < bmp_start + bmp_num_bytes) {
+            resource_num_bytes = bmp_start + bmp_num_bytes;
+        }
+    }
+    if (resource_num_bytes > fnt_data.num_bytes) {
+        resource_num_bytes = fnt_data.num_bytes;
+    }
+
+    FullFnt *full_fnt = arena->New<FullFnt>();
+    full_fnt->resource = fnt_data.Sub(0, resource_num_bytes);
+    full_fnt->hdr = fnt;
+    full_fnt->glyphs = glyphs;
+
+    // Get the name. It must be terminated before the end of the file.
+    full_fnt->name = "";
+    const char *name = fnt_data.Get<char>(fnt->name_offset);
+    if (name && memchr(name, '\0', fnt_data.num_bytes - fnt->name_offset)) {
+        full_fnt->name = name;
+    }
+
+    return full_fnt;
+}
+
+
+// A GlyphSheet that, along with its bits, lives in arena.
+static GlyphSheet *NewGlyphSheet(int width, int height, Arena *arena) {
+    return new (arena->Alloc(sizeof(GlyphSheet))) GlyphSheet(width, height, arena);
+}
+
+
+// Gets where each byte column of one band of 16 glyphs starts in the
+// resource, and the x in the sheet that it goes to. A column holds
+// pix_height bytes, one per scanline, of 8 pixels each.
+static void GetBandColumns(FullFnt *fnt, int band, std::vector<const u8 *> *columns,
+                           std::vector<int> *column_xs) {
+    const FntHeader *hdr = fnt->hdr;
+    columns->clear();
+    column_xs->clear();
+    for (int i = band * 16; i < (band + 1) * 16; i++) {
+        int num_columns = (fnt->glyphs[i].pix_width + 7) / 8;
+        for (int column = 0; column < num_columns; column++) {
+            size_t bmp_offset = fnt->glyphs[i].bitmap_offset + (size_t)hdr->pix_height * column;
+            columns->push_back(fnt->resource.data + bmp_offset);
+            column_xs->push_back((i % 16) * hdr->max_width + column * 8);
+        }
+    }
+}
+
+
+// Up to 56 bits of one row of a band's transposed bytes, that go to the
+// sheet together.
+struct TransposedWord {
+    int k;          // Index of the first column.
+    int x;          // Where that column goes in the sheet.
+    int num_bits;
+};
+
+
+void UnpackGlyphs(FullFnt *fnt, Arena *arena) {
+    if (fnt->sheet) {
+        return;
+    }
+
+    const FntHeader *hdr = fnt->hdr;
+
+    // Unpack the glyphs into the sheet, one band of 16 glyphs at a time. The
+    // transpose kernel turns all the band's glyph columns, read straight out
+    // of the mapped file, into row-major bytes. Those are then ORed into the
+    // band's scanlines.
+    GlyphSheet *sheet = NewGlyphSheet(16 * hdr->max_width, 14 * hdr->pix_height, arena);
+    fnt->sheet = sheet;
+    TransposeKernel *transpose = GetTransposeKernel();
+    std::vector<const u8 *> columns;
+    std::vector<int> column_xs;
+    std::vector<TransposedWord> words;
+    std::vector<u8> transposed;
+    for (int band = 0; band < 14; band++) {
+        GetBandColumns(fnt, band, &columns, &column_xs);
+
+        int num_columns = columns.size();
+        if (num_columns == 0) {
+            continue;
+        }
+
+        // Columns that are next to each other in the sheet, which includes
+        // all the columns of a glyph, are next to each other in the
+        // transposed bytes too. So each row is ORed in as words of up to 7
+        // such bytes. Split the band's columns into those words up front.
+        words.clear();
+        for (int k = 0; k < num_columns; k++) {
+            if (k == 0 || column_xs[k] != column_xs[k - 1] + 8 || words.back().num_bits == 56) {
+                TransposedWord word = { k, column_xs[k], 0 };
+                words.push_back(word);
+            }
+            words.back().num_bits += 8;
+        }
+
+        // The 8 extra bytes are for the word loads at the end of the last row.
+        int stride = (num_columns + 15) & ~15;
+        transposed.resize(stride * hdr->pix_height + 8);
+        transpose(&transposed[0], stride, &columns[0], num_columns, hdr->pix_height,
+            fnt->resource.data + fnt->resource.num_bytes);
+
+        int y0 = band * hdr->pix_height;
+        for (int y = 0; y < hdr->pix_height; y++) {
+            const u8 *row_bytes = &transposed[y * stride];
+            u64 *row = sheet->Row(y0 + y);
+            for (unsigned i = 0; i < words.size(); i++) {
+                TransposedWord const &word = words[i];
+                // The leftmost byte is the least significant, as on every
+                // little endian CPU we build for.
+                u64 pixels;
+                memcpy(&pixels, row_bytes + word.k, sizeof(pixels));
+                pixels &= (1ULL << word.num_bits) - 1;
+                OrBitsIntoRow(row, sheet->width, word.x, pixels, word.num_bits);
+            }
+        }
+    }
+}
+
+
+bool ParseFon(ByteView file, FullFnt **fnts, int *num_fnts, Arena *arena, ConvertError *err) {
+    *num_fnts = 0;
+
+    const OldExeHeader *old_hdr = file.Get<OldExeHeader>(0);
+    if (!old_hdr) {
+        return err->Set("File is too small to be a .fon");
+    }
+    //printf("Read old header of size %i\n", sizeof(OldExeHeader));
+    
+    int new_hdr_offset = old_hdr->num_paragraphs_in_header * 16 + sizeof(OldExeHeader);
+    //printf("New header spans 0x%x to 0x%x.\n", new_hdr_offset, new_hdr_offset + sizeof(NewExeHeader) - 1);
+
+    const NewExeHeader *new_hdr = file.Get<NewExeHeader>(new_hdr_offset);
+    if (!new_hdr) {
+        return err->Set("New exe header at 0x%x is past the end of the file", new_hdr_offset);
+    }
+    //printf("New header ID is %c%c\n", new_hdr->id[0], new_hdr->id[1]);
+    
+    //int seg_table_offset = new_hdr_offset + new_hdr->seg_table_offset;
+    //printf("Seg table spans 0x%x to 0x%x\n", seg_table_offset,
+//        seg_table_offset + new_hdr->seg_table_num_items * 8 - 1);
+
+    int res_table_offset = new_hdr_offset + new_hdr->res_table_offset;
+    //int res_table_num_blocks = new_hdr->num_resource_entries / sizeof(ResourceTableBlock);
+    //printf("Resource table num blocks is %i\n", res_table_num_blocks);
+    //printf("Resource table spans 0x%x to 0x%x\n", res_table_offset, new_hdr->num_resource_entries * sizeof(ResourceTableBlock));
+
+    //printf("Resident name table offset is 0x%x\n", new_hdr->resi_name_table_offset + new_hdr_offset);
+    //printf("Module ref table offset is 0x%x\n", new_hdr->module_ref_table_offset + new_hdr_offset);
+    //printf("Imported name table offset is 0x%x\n", new_hdr->imported_names_table_offset + new_hdr_offset);
+    //printf("Non resi name table offset 0x%x. Num items %i\n", new_hdr->non_resi_name_table_offset,
+//        new_hdr->non_resi_name_table_offset + new_hdr->non_resi_name_table_num_bytes);
+    
+    const ResorceTable *res_table = file.Get<ResorceTable>(res_table_offset);
+    if (!res_table || res_table->alignment_shift_amount > 16) {
+        return err->Set("Bad resource table at 0x%x", res_table_offset);
+    }
+    int block_size = 1 << res_table->alignment_shift_amount;
+
+    size_t offset = res_table_offset + sizeof(ResorceTable);
+    while (1) {
+        //printf("\nResource block offset 0x%x. ", offset);
+        const ResourceTableBlock *rtblock = file.Get<ResourceTableBlock>(offset);
+        if (!rtblock) {
+            return err->Set("Resource table runs past the end of the file");
+        }
+        //printf("type id 0x%x. Num of this type %i\n", rtblock->type_id, rtblock->num_of_this_type);
+        offset += sizeof(ResourceTableBlock);
+
+        if (rtblock->type_id == 0) {
+            break;
+        }
+
+        const ResourceTableItem *rt_items = file.Get<ResourceTableItem>(offset, rtblock->num_of_this_type);
+        if (!rt_items) {
+            return err->Set("Resource table runs past the end of the file");
+        }
+
+        if (rtblock->type_id == 0x8008) {
+            if (rtblock->num_of_this_type > MAX_FNTS_PER_FILE) {
+                return err->Set("Too many fonts (%d)", rtblock->num_of_this_type);
+            }
+
+            for (int i = 0; i < rtblock->num_of_this_type; i++) {
+                fnts[i] = ReadFntResourceItem(file, rt_items + i, block_size, arena, err);
+                if (!fnts[i]) {
+                    return false;
+                }
+                (*num_fnts)++;
+            }
+
+            break;
+        }
+        else {
+            if (rtblock->type_id == 0x8007 && rtblock->num_of_this_type > 0) {
+                if (rt_items[0].resource_id & 0x8000) {
+                    return err->Set("Bad resource id 2");
+                }
+                //printf("Font dir name %s\n", resource_table + rt_items[0].resource_id);
+            }
+    
+            offset += sizeof(ResourceTableItem) * rtblock->num_of_this_type;
+        }
+    }
+
+    if (*num_fnts == 0) {
+        return err->Set("No FONT resources found");
+    }
+
+    return true;
+}
+
+
+// Builds the mask for one band of 16 glyphs. It is set over each glyph's
+// pix_width and clear over the padding to its right, where proportional
+// width glyphs are narrower than the widest glyph. Glyphs can have set bits
+// in the padding, because the FNT data is whole bytes wide.
+static void BuildWidthMask(u64 *mask, int stride, FullFnt *fnt, int band) {
+    int max_width = fnt->hdr->max_width;
+
+    memset(mask, 0, stride * sizeof(u64));
+    for (int cell_col = 0; cell_col < 16; cell_col++) {
+        int i = band * 16 + cell_col;
+        int glyph_width = max_width;
+        if (fnt->glyphs[i].pix_width < max_width) {
+            glyph_width = fnt->glyphs[i].pix_width;
+        }
+        int x0 = cell_col * max_width;
+        SetBitRange(mask, x0, x0 + glyph_width);
+    }
+}
+
+
+void ApplyWidthMasks(GlyphSheet *sheet, FullFnt *fnt, Arena *arena) {
+    int pix_height = fnt->hdr->pix_height;
+    u64 *mask = arena->New<u64>(sheet->stride);
+    for (int band = 0; band < 14; band++) {
+        BuildWidthMask(mask, sheet->stride, fnt, band);
+        for (int y = band * pix_height; y < (band + 1) * pix_height; y++) {
+            u64 *row = sheet->Row(y);
+            for (int j = 0; j < sheet->stride; j++) {
+                row[j] &= mask[j];
+            }
+        }
+    }
+}
+
+
+// Packs nibbles into a u64 and hands them to the MemBuf 16 at a time,
+// instead of one call per nibble.
+struct NibbleAccumulator {
+    MemBuf *buf;
+    u64 nibbles;
+    int num_nibbles;
+
+    NibbleAccumulator(MemBuf *_buf) {
+        buf = _buf;
+        nibbles = 0;
+        num_nibbles = 0;
+    }
+
+    // The first nibble is in the low 4 bits of vals. count must be <= 8.
+    void Push(u64 vals, int count) {
+        if (num_nibbles + count > 16) {
+            Flush();
+        }
+        nibbles |= vals << (num_nibbles * 4);
+        num_nibbles += count;
+    }
+
+    void Flush() {
+        buf->PushNibbles(nibbles, num_nibbles);
+        nibbles = 0;
+        num_nibbles = 0;
+    }
+};
+
+
+// Appends the nibbles for one run. Runs of 16 or more are written as the
+// escape nibble 0 followed by an 8-bit length, low nibble first.
+static void EncodeRun(NibbleAccumulator *out, int run_len) {
+    while (run_len >= 16) {
+        if (run_len > 255) {
+            // There is no way to encode a run this long directly. Instead we
+            // output multiple runs that add up to the required total. But
+            // adjacent runs must be of opposite "values", so a zero length
+            // run, which also needs the escape, goes between each of them.
+            out->Push(0x000ff0, 6);
+            run_len -= 255;
+        }
+        else {
+            out->Push((u64)run_len << 4, 3);
+            return;
+        }
+    }
+
+    if (run_len > 0) {
+        out->Push(run_len, 1);
+    }
+    else {
+        // Only happens if the very first pixel is a 1. The stream always
+        // starts with a run of 0s, so that needs a zero length run.
+        out->Push(0x000, 3);
+    }
+}
+
+
+// Run encoders for FindRuns(). Nibble runs are the original format, and
+// are smallest when most runs are short.
+struct NibbleRuns {
+    NibbleAccumulator out;
+
+    NibbleRuns(MemBuf *buf) : out(buf) {
+    }
+
+    void Run(int run_len) {
+        EncodeRun(&out, run_len);
+    }
+
+    void Finish() {
+        out.Flush();
+    }
+};
+
+
+// One byte per run. Runs longer than 255 are split up with zero length runs,
+// the same as nibble runs, and a leading 1 pixel needs a zero length run.
+struct ByteRuns {
+    MemBuf *buf;
+
+    ByteRuns(MemBuf *_buf) {
+        buf = _buf;
+    }
+
+    void Run(int run_len) {
+        while (run_len > 255) {
+            buf->PushByte(255);
+            buf->PushByte(0);
+            run_len -= 255;
+        }
+        buf->PushByte(run_len);
+    }
+
+    void Finish() {
+    }
+};
+
+
+// Splits rows of pixels into runs, as one stream, left to right and top to
+// bottom, starting with a run of 0s. Rather than visiting every pixel, each
+// u64 is XORed with the colour of the current run and the next run boundary
+// found with a count trailing zeros. The final run is not written; decoders
+// treat the rest of the sheet as that colour. Rows are fed in one at a time,
+// so they needn't come from a whole sheet.
+template <class RunEncoder>
+struct RunFinder {
+    RunEncoder *out;
+    u64 cur_colour;                 // All 0s or all 1s.
+    int run_len;
+
+    RunFinder(RunEncoder *_out) {
+        out = _out;
+        cur_colour = 0;
+        run_len = 0;
+    }
+
+    void AddRow(const u64 *row, int width) {
+        int stride = (width + 63) / 64;
+        for (int j = 0; j < stride; j++) {
+            int num_bits = width - j * 64;
+            if (num_bits > 64) {
+                num_bits = 64;
+            }
+            u64 valid = num_bits == 64 ? ~0ULL : (1ULL << num_bits) - 1;
+            u64 differs = (row[j] ^ cur_colour) & valid;
+            int pos = 0;
+
+            while (differs) {
+                int boundary = CountTrailingZeros(differs);
+                run_len += boundary - pos;
+                out->Run(run_len);
+                run_len = 0;
+                cur_colour = ~cur_colour;
+                pos = boundary;
+
+                // Bits from the boundary on that differ from the new colour.
+                differs = (row[j] ^ cur_colour) & valid & (~0ULL << pos);
+            }
+
+            run_len += num_bits - pos;
+        }
+    }
+
+    void Finish() {
+        out->Finish();
+    }
+};
+
+
+template <class RunEncoder>
+static void FindRuns(const GlyphSheet *sheet, RunEncoder *out) {
+    RunFinder<RunEncoder> finder(out);
+    for (int y = 0; y < sheet->height; y++) {
+        finder.AddRow(sheet->Row(y), sheet->width);
+    }
+    finder.Finish();
+}
+
+
+// Wraps a run encoder to fill in RunStats as well. Only used when metrics
+// are being collected, so that the usual path doesn't pay for the counting.
+// byte_runs says which format out writes. Both split long runs the same
+// way, but only nibble runs have escapes.
+template <class RunEncoder>
+struct CountedRuns {
+    RunEncoder *out;
+    RunStats *stats;
+    bool byte_runs;
+
+    CountedRuns(RunEncoder *_out, RunStats *_stats, bool _byte_runs) {
+        out = _out;
+        stats = _stats;
+        byte_runs = _byte_runs;
+    }
+
+    // Counts the runs, and escapes that EncodeRun() would write.
+    void Run(int run_len) {
+        int remaining = run_len;
+        while (remaining > 255) {
+            stats->num_runs += 2;
+            if (!byte_runs) {
+                stats->num_escapes += 2;
+            }
+            remaining -= 255;
+        }
+        stats->num_runs++;
+        if (!byte_runs && (remaining >= 16 || remaining == 0)) {
+            stats->num_escapes++;
+        }
+        out->Run(run_len);
+    }
+
+    void Finish() {
+        out->Finish();
+    }
+};
+
+
+template <class RunEncoder>
+static void FindRunsCounted(const GlyphSheet *sheet, RunEncoder *out, bool byte_runs,
+                            RunStats *stats) {
+    if (!stats) {
+        FindRuns(sheet, out);
+        return;
+    }
+    CountedRuns<RunEncoder> counted(out, stats, byte_runs);
+    FindRuns(sheet, &counted);
+}
+
+
+// stats can be NULL.
+void EncodeRuns(MemBuf *buf, const GlyphSheet *sheet, bool byte_runs, RunStats *stats) {
+    if (byte_runs) {
+        ByteRuns out(buf);
+        FindRunsCounted(sheet, &out, true, stats);
+    }
+    else {
+        NibbleRuns out(buf);
+        FindRunsCounted(sheet, &out, false, stats);
+    }
+}
+
+
+// The classic encoding, up-prediction and nibble runs, streamed straight
+// from the FNT data without building the glyph sheet. Each scanline is
+// gathered from the band's glyph columns, masked, XORed with the masked
+// scanline above and split into runs before the next is started. So only
+// two scanlines and a mask are held, however big the font is, and each is
+// still in cache when it is used. The output is the same as unpacking the
+// sheet, applying the width masks and up-prediction, then EncodeRuns().
+template <class RunEncoder>
+static void StreamClassicRuns(FullFnt *fnt, RunEncoder *out, Arena *arena) {
+    const FntHeader *hdr = fnt->hdr;
+    int width = 16 * hdr->max_width;
+    int stride = (width + 63) / 64;
+    if (stride == 0) {
+        stride = 1;
+    }
+
+    u64 *row = arena->New<u64>(stride);
+    u64 *prev_row = arena->New<u64>(stride);
+    u64 *mask = arena->New<u64>(stride);
+
+    std::vector<const u8 *> columns;
+    std::vector<int> column_xs;
+    RunFinder<RunEncoder> finder(out);
+    for (int band = 0; band < 14; band++) {
+        BuildWidthMask(mask, stride, fnt, band);
+        GetBandColumns(fnt, band, &columns, &column_xs);
+        int num_columns = columns.size();
+
+        for (int y = 0; y < hdr->pix_height; y++) {
+            memset(row, 0, stride * sizeof(u64));
+            for (int k = 0; k < num_columns; k++) {
+                OrByteIntoRow(row, width, column_xs[k], ReverseBits(columns[k][y]));
+            }
+
+            for (int j = 0; j < stride; j++) {
+                u64 masked = row[j] & mask[j];
+                row[j] = masked ^ prev_row[j];
+                prev_row[j] = masked;
+            }
+            finder.AddRow(row, width);
+        }
+    }
+    finder.Finish();
+}
+
+
+// stats can be NULL.
+static void EncodeClassicStreamed(MemBuf *buf, FullFnt *fnt, Arena *arena, RunStats *stats) {
+    NibbleRuns out(buf);
+    if (!stats) {
+        StreamClassicRuns(fnt, &out, arena);
+        return;
+    }
+    CountedRuns<NibbleRuns> counted(&out, stats, false);
+    StreamClassicRuns(fnt, &counted, arena);
+}
+
+
+static void WriteWidthTable(MemBuf *buf, FullFnt *fnt) {
+    for (int c = 0; c < 224; c++) {
+        buf->PushByte(fnt->glyphs[c].pix_width);
+    }
+}
+
+
+// A version 1 font's glyph cells, width masked and stacked one above the
+// other, so that cell c is rows c * pix_height onwards. Cells that are
+// bit-identical to an earlier one, like blanks and repeated box drawing
+// glyphs, only get encoded once. refs[c] says which unique bitmap cell c
+// uses. They are numbered in order of first use, and unique_cells[u] is
+// the first cell that uses bitmap u.
+//
+// With packing, each bitmap only covers rects[u], as x, y, width and height
+// within the cell. Everything outside it is 0.
+struct GlyphCells {
+    GlyphSheet *cells;
+    int pix_height;
+    u8 refs[224];
+    int unique_cells[224];
+    int num_unique;
+    bool packed;
+    u8 rects[224][4];
+};
+
+
+static u64 HashCell(const GlyphSheet *cells, int c, int pix_height) {
+    // 64-bit FNV-1a over the cell's words.
+    u64 hash = 0xcbf29ce484222325ULL;
+    const u64 *words = cells->Row(c * pix_height);
+    for (int i = 0; i < cells->stride * pix_height; i++) {
+        hash = (hash ^ words[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+static void SplitIntoCells(const GlyphSheet *sheet, int max_width, int pix_height,
+                           GlyphCells *glyph_cells, Arena *arena) {
+    GlyphSheet *cells = NewGlyphSheet(max_width, 224 * pix_height, arena);
+    for (int c = 0; c < 224; c++) {
+        int x0 = (c % 16) * max_width;
+        int y0 = (c / 16) * pix_height;
+        for (int y = 0; y < pix_height; y++) {
+            CopyBits(cells->Row(c * pix_height + y), 0, sheet->Row(y0 + y), x0, max_width);
+        }
+    }
+    glyph_cells->cells = cells;
+    glyph_cells->pix_height = pix_height;
+
+    // Cells with the same hash are compared in full, in case of collisions.
+    u64 hashes[224];
+    int cell_num_bytes = cells->stride * pix_height * sizeof(u64);
+    glyph_cells->num_unique = 0;
+    for (int c = 0; c < 224; c++) {
+        hashes[c] = HashCell(cells, c, pix_height);
+        int u = 0;
+        for (; u < glyph_cells->num_unique; u++) {
+            int other = glyph_cells->unique_cells[u];
+            if (hashes[other] == hashes[c] &&
+                memcmp(cells->Row(other * pix_height), cells->Row(c * pix_height), cell_num_bytes) == 0) {
+                break;
+            }
+        }
+        if (u == glyph_cells->num_unique) {
+            glyph_cells->unique_cells[u] = c;
+            glyph_cells->num_unique++;
+        }
+        glyph_cells->refs[c] = u;
+    }
+}
+
+
+// Works out the area each unique bitmap's data covers. PACK_WIDTH is the
+// glyph's pix_width columns, skipping the padding to the right of a
+// proportional glyph. PACK_INK is the bounding box of its set pixels.
+// Glyphs sharing a bitmap have the same pixels, so all their ink is inside
+// the first one's pix_width.
+static void FindPackedRects(GlyphCells *glyph_cells, FullFnt *fnt, int packing) {
+    glyph_cells->packed = packing != PACK_CELLS;
+    if (!glyph_cells->packed) {
+        return;
+    }
+
+    const GlyphSheet *cells = glyph_cells->cells;
+    int pix_height = glyph_cells->pix_height;
+    for (int u = 0; u < glyph_cells->num_unique; u++) {
+        int c = glyph_cells->unique_cells[u];
+        u8 *rect = glyph_cells->rects[u];
+        int width = cells->width;
+        if (fnt->glyphs[c].pix_width < width) {
+            width = fnt->glyphs[c].pix_width;
+        }
+        rect[0] = 0;
+        rect[1] = 0;
+        rect[2] = width;
+        rect[3] = pix_height;
+        if (packing != PACK_INK) {
+            continue;
+        }
+
+        int x0 = width, x1 = 0, y0 = pix_height, y1 = 0;
+        for (int y = 0; y < pix_height; y++) {
+            for (int x = 0; x < width; x++) {
+                if (cells->GetPix(x, c * pix_height + y)) {
+                    if (x < x0) x0 = x;
+                    if (x >= x1) x1 = x + 1;
+                    if (y < y0) y0 = y;
+                    y1 = y + 1;
+                }
+            }
+        }
+        if (x1 == 0) {
+            // No ink at all.
+            x0 = 0;
+            y0 = 0;
+            y1 = 0;
+        }
+        rect[0] = x0;
+        rect[1] = y0;
+        rect[2] = x1 - x0;
+        rect[3] = y1 - y0;
+    }
+}
+
+
+// Version 1 glyph data: every unique glyph bitmap is predicted and run
+// length encoded on its own, starting on a byte boundary. offsets[u] is
+// where bitmap u starts, and offsets[num_unique] is the end of the data.
+// Packed bitmaps start with their 4 byte rect, and only cover that.
+static void EncodeGlyphCells(MemBuf *glyph_data, u32 *offsets, const GlyphCells *glyph_cells,
+                             int predictor, bool byte_runs, Arena *arena, ConvertMetrics *metrics,
+                             RunStats *stats) {
+    const GlyphSheet *cells = glyph_cells->cells;
+    int pix_height = glyph_cells->pix_height;
+    GlyphSheet cell(cells->width, pix_height, arena);
+    for (int u = 0; u < glyph_cells->num_unique; u++) {
+        offsets[u] = glyph_data->data_num_bytes;
+
+        int c = glyph_cells->unique_cells[u];
+        if (!glyph_cells->packed) {
+            {
+                StageTimer timer(metrics, STAGE_PREDICT);
+                memcpy(cell.bits, cells->Row(c * pix_height), cell.stride * pix_height * sizeof(u64));
+                ApplyPredictor(&cell, predictor, cells->width, arena);
+            }
+            StageTimer timer(metrics, STAGE_RUNS);
+            EncodeRuns(glyph_data, &cell, byte_runs, stats);
+            glyph_data->FlushNibble();
+            continue;
+        }
+
+        const u8 *rect = glyph_cells->rects[u];
+        glyph_data->PushBytes(rect, 4);
+        GlyphSheet area(rect[2], rect[3], arena);
+        {
+            StageTimer timer(metrics, STAGE_PREDICT);
+            for (int y = 0; y < rect[3]; y++) {
+                CopyBits(area.Row(y), 0, cells->Row(c * pix_height + rect[1] + y), rect[0], rect[2]);
+            }
+            ApplyPredictor(&area, predictor, rect[2], arena);
+        }
+        StageTimer timer(metrics, STAGE_RUNS);
+        EncodeRuns(glyph_data, &area, byte_runs, stats);
+        glyph_data->FlushNibble();
+    }
+    offsets[glyph_cells->num_unique] = glyph_data->data_num_bytes;
+}
+
+
+// Copies trial into best if it is smaller, or if best_flags is -1 because
+// there isn't a best yet.
+static bool KeepIfSmaller(MemBuf *best, int *best_flags, const MemBuf *trial, int flags) {
+    if (*best_flags != -1 && trial->data_num_bytes >= best->data_num_bytes) {
+        return false;
+    }
+    best->Reset();
+    best->PushBytes(trial->data, trial->data_num_bytes);
+    *best_flags = flags;
+    return true;
+}
+
+
+// Encodes the masked glyph sheet with each predictor and run format that
+// opts allow, and leaves the smallest result in best. For version 1, which
+// passes in glyph_cells, offsets gets the start of each unique bitmap.
+// Returns the flag bits saying which was used. Ties go to the earlier
+// candidate, so a font that does no better than up-prediction and nibble
+// runs comes out as before. With metrics, best_stats gets the run counts of
+// the one kept.
+static int EncodeSmallest(MemBuf *best, u32 *offsets, FullFnt *fnt, const GlyphCells *glyph_cells,
+                          ConvertOptions const &opts, Arena *arena, ConvertMetrics *metrics,
+                          RunStats *best_stats) {
+    int version = glyph_cells ? 1 : 0;
+    const GlyphSheet *sheet = fnt->sheet;
+    int max_width = fnt->hdr->max_width;
+
+    // Version 1 glyphs must decode on their own, so can't be predicted
+    // from the glyph before.
+    int num_predictors = version >= 1 ? PREDICT_PREV_GLYPH : NUM_PREDICTORS;
+    int num_run_formats = 2;
+    if (opts.codec == CODEC_CLASSIC) {
+        num_predictors = 1;
+        num_run_formats = 1;
+    }
+
+    // Huffman coding needs the nibble count, which a version 1 glyph's
+    // index entry doesn't give. Storing one per glyph would cost more than
+    // coding such short streams saves, so it is version 0 only.
+    bool huffman = opts.huffman && version == 0;
+
+    GlyphSheet predicted(version >= 1 ? 0 : sheet->width, version >= 1 ? 0 : sheet->height, arena);
+    MemBuf trial;
+    MemBuf coded;
+    u32 trial_offsets[225];
+    int best_flags = -1;
+
+    for (int predictor = 0; predictor < num_predictors; predictor++) {
+        if (version == 0) {
+            StageTimer timer(metrics, STAGE_PREDICT);
+            memcpy(predicted.bits, sheet->bits, sheet->stride * sheet->height * sizeof(u64));
+            ApplyPredictor(&predicted, predictor, max_width, arena);
+        }
+
+        for (int byte_runs = 0; byte_runs < num_run_formats; byte_runs++) {
+            int flags = predictor << DFBF_PREDICTOR_SHIFT;
+            if (byte_runs) {
+                flags |= DFBF_FLAG_BYTE_RUNS;
+            }
+
+            trial.Reset();
+            RunStats trial_stats;
+            RunStats *stats = metrics ? &trial_stats : NULL;
+            int num_nibbles = 0;
+            if (version >= 1) {
+                EncodeGlyphCells(&trial, trial_offsets, glyph_cells, predictor, byte_runs != 0,
+                                 arena, metrics, stats);
+            }
+            else {
+                StageTimer timer(metrics, STAGE_RUNS);
+                EncodeRuns(&trial, &predicted, byte_runs != 0, stats);
+                num_nibbles = trial.data_num_bytes * 2 + trial.hi_nibble_next;
+                trial.FlushNibble();
+            }
+
+            if (KeepIfSmaller(best, &best_flags, &trial, flags)) {
+                if (version >= 1) {
+                    memcpy(offsets, trial_offsets, sizeof(trial_offsets));
+                }
+                if (best_stats) {
+                    *best_stats = trial_stats;
+                }
+            }
+
+            if (huffman && !byte_runs) {
+                StageTimer timer(metrics, STAGE_HUFFMAN);
+                coded.Reset();
+                HuffmanEncodeNibbles(&coded, trial.data, num_nibbles);
+                if (KeepIfSmaller(best, &best_flags, &coded, flags | DFBF_FLAG_HUFFMAN) && best_stats) {
+                    *best_stats = trial_stats;
+                }
+            }
+        }
+    }
+
+    return best_flags;
+}
+
+
+static void PushOffset(MemBuf *buf, u32 offset, int flags) {
+    if (flags & DFBF_FLAG_WIDE_OFFSETS) {
+        buf->PushBytes(&offset, 4);
+    }
+    else {
+        u16 narrow = offset;
+        buf->PushBytes(&narrow, 2);
+    }
+}
+
+
+// Version 1 body: an index of where each glyph's data starts comes before
+// the data, so that a consumer can decode just the glyphs it needs. The
+// index has 225 entries, the last marking the end of the data, as offsets
+// from the end of the index. They are u16 unless DFBF_FLAG_WIDE_OFFSETS is
+// set, in which case they are u32.
+//
+// If DFBF_FLAG_GLYPH_REFS is set, identical glyphs share their data. The
+// index is then a u8 count of unique bitmaps, a u8 per glyph saying which
+// bitmap it uses, and count + 1 offsets to the bitmaps' data. This is used
+// whenever it comes out smaller.
+//
+// If DFBF_FLAG_PACKED is set, each bitmap's data starts with the x, y,
+// width and height of the area of the cell it covers, a byte each, and
+// only encodes that area.
+static void WriteGlyphIndexedBody(MemBuf *buf, FullFnt *fnt, int flags, ConvertOptions const &opts,
+                                  Arena *arena, ConvertMetrics *metrics, RunStats *stats) {
+    {
+        StageTimer timer(metrics, STAGE_MASK);
+        ApplyWidthMasks(fnt->sheet, fnt, arena);
+    }
+
+    GlyphCells glyph_cells;
+    {
+        StageTimer timer(metrics, STAGE_CELLS);
+        SplitIntoCells(fnt->sheet, fnt->hdr->max_width, fnt->hdr->pix_height, &glyph_cells, arena);
+        FindPackedRects(&glyph_cells, fnt, opts.packing);
+    }
+    if (glyph_cells.packed) {
+        flags |= DFBF_FLAG_PACKED;
+    }
+
+    MemBuf glyph_data;
+    u32 offsets[225];
+    flags |= EncodeSmallest(&glyph_data, offsets, fnt, &glyph_cells, opts, arena, metrics, stats);
+
+    int num_unique = glyph_cells.num_unique;
+    const u8 *refs = glyph_cells.refs;
+    u32 shared_num_bytes = offsets[num_unique];
+    u32 unshared_num_bytes = 0;
+    for (int c = 0; c < 224; c++) {
+        unshared_num_bytes += offsets[refs[c] + 1] - offsets[refs[c]];
+    }
+    int shared_offset_size = shared_num_bytes > 0xffff ? 4 : 2;
+    int unshared_offset_size = unshared_num_bytes > 0xffff ? 4 : 2;
+    u32 shared_size = 1 + 224 + (num_unique + 1) * shared_offset_size + shared_num_bytes;
+    u32 unshared_size = 225 * unshared_offset_size + unshared_num_bytes;
+    bool shared = shared_size < unshared_size;
+
+    if (shared) {
+        flags |= DFBF_FLAG_GLYPH_REFS;
+    }
+    if ((shared ? shared_offset_size : unshared_offset_size) == 4) {
+        flags |= DFBF_FLAG_WIDE_OFFSETS;
+    }
+    buf->PushByte(flags);
+    if (flags & DFBF_FLAG_PROPORTIONAL) {
+        WriteWidthTable(buf, fnt);
+    }
+
+    if (shared) {
+        buf->PushByte(num_unique);
+        buf->PushBytes(refs, 224);
+        for (int u = 0; u <= num_unique; u++) {
+            PushOffset(buf, offsets[u], flags);
+        }
+        buf->PushBytes(glyph_data.data, glyph_data.data_num_bytes);
+        return;
+    }
+
+    u32 offset = 0;
+    for (int c = 0; c < 224; c++) {
+        PushOffset(buf, offset, flags);
+        offset += offsets[refs[c] + 1] - offsets[refs[c]];
+    }
+    PushOffset(buf, offset, flags);
+    for (int c = 0; c < 224; c++) {
+        buf->PushBytes(glyph_data.data + offsets[refs[c]], offsets[refs[c] + 1] - offsets[refs[c]]);
+    }
+}
+
+
+void WriteDfbfToMemBuf(MemBuf *buf, FullFnt *fnt, ConvertOptions const &opts, Arena *arena,
+                       ConvertMetrics *metrics) {
+    // ConvertFile() fills in the rest once the blob is complete.
+    RunStats *stats = NULL;
+    if (metrics) {
+        metrics->fonts.push_back(FontMetrics());
+        stats = &metrics->fonts.back().runs;
+    }
+
+    buf->PushByte(fnt->hdr->max_width);
+    buf->PushByte(fnt->hdr->pix_height);
+
+    int flags = 0;
+    if (fnt->hdr->pix_width == 0) {
+        flags |= DFBF_FLAG_PROPORTIONAL;
+    }
+
+    // The classic encoding is streamed, and never needs the glyph sheet.
+    bool streamed = opts.dfbf_version == 0 && opts.codec == CODEC_CLASSIC && !opts.huffman;
+    if (!streamed) {
+        StageTimer timer(metrics, STAGE_UNPACK);
+        UnpackGlyphs(fnt, arena);
+    }
+
+    if (opts.dfbf_version >= 1) {
+        WriteGlyphIndexedBody(buf, fnt, flags, opts, arena, metrics, stats);
+        return;
+    }
+
+    if (streamed) {
+        // The predictor and run format bits are all 0 for this, so it can
+        // be encoded straight into buf.
+        buf->PushByte(flags);
+        if (flags & DFBF_FLAG_PROPORTIONAL) {
+            WriteWidthTable(buf, fnt);
+        }
+        StageTimer timer(metrics, STAGE_RUNS);
+        EncodeClassicStreamed(buf, fnt, arena, stats);
+        return;
+    }
+
+    {
+        StageTimer timer(metrics, STAGE_MASK);
+        ApplyWidthMasks(fnt->sheet, fnt, arena);
+    }
+    MemBuf data;
+    flags |= EncodeSmallest(&data, NULL, fnt, NULL, opts, arena, metrics, stats);
+
+    buf->PushByte(flags);
+
+    // If fnt is variable width, write the glyph widths table.
+    if (flags & DFBF_FLAG_PROPORTIONAL) {
+        WriteWidthTable(buf, fnt);
+    }
+
+    buf->PushBytes(data.data, data.data_num_bytes);
+}
+
+
+char *GetNameFromPath(const char *path, Arena *arena) {
+    const char *slash = strrchr(path, '/');
+    const char *back_slash = strrchr(path, '\\');
+    if (back_slash > slash) {
+        slash = back_slash;
+    }
+    const char *start = slash ? slash + 1 : path;
+    const char *dot = strrchr(start, '.');
+    if (!dot) {
+        dot = start + strlen(start);
+    }
+    return arena->Printf("%.*s", (int)(dot - start), start);
+}
+
+
+// Unpacks the glyphs into a sheet the simple way, a pixel at a time, and
+// applies the width masks. This is what the .dfbf should decode to, built
+// independently of the transpose kernels and encoder.
+static GlyphSheet *UnpackGlyphsReference(FullFnt *fnt, Arena *arena) {
+    const FntHeader *hdr = fnt->hdr;
+    GlyphSheet *sheet = NewGlyphSheet(16 * hdr->max_width, 14 * hdr->pix_height, arena);
+    for (int i = 0; i < 224; i++) {
+        int num_columns = (fnt->glyphs[i].pix_width + 7) / 8;
+        for (int column = 0; column < num_columns; column++) {
+            int x0 = (i % 16) * hdr->max_width + column * 8;
+            int y0 = (i / 16) * hdr->pix_height;
+            size_t bmp_offset = fnt->glyphs[i].bitmap_offset + (size_t)hdr->pix_height * column;
+            const u8 *glyph = fnt->resource.data + bmp_offset;
+            for (int y = 0; y < hdr->pix_height; y++) {
+                for (int x = 0; x < 8; x++) {
+                    if ((glyph[y] & (0x80 >> x)) && x0 + x < sheet->width) {
+                        sheet->PutPix(x0 + x, y0 + y, 1);
+                    }
+                }
+            }
+        }
+    }
+
+    ApplyWidthMasks(sheet, fnt, arena);
+    return sheet;
+}
+
+
+// Decodes every font in a .dfbf and checks it matches the .fon it came from.
+static bool VerifyDfbf(const MemBuf *dfbf, FullFnt **all_fnts, int num_fnts, Arena *arena,
+                       ConvertError *err) {
+    ByteView blobs[MAX_FNTS_PER_FILE];
+    int num_blobs = 0;
+    int version = 0;
+    if (!SplitDfbfFile(ByteView(dfbf->data, dfbf->data_num_bytes), blobs, MAX_FNTS_PER_FILE,
+                       &num_blobs, &version, err)) {
+        return false;
+    }
+    if (num_blobs != num_fnts) {
+        return err->Set("Verify: .dfbf has %d fonts, expected %d", num_blobs, num_fnts);
+    }
+
+    for (int i = 0; i < num_fnts; i++) {
+        FullFnt *fnt = all_fnts[i];
+        DecodedFont decoded;
+        if (!DecodeDfbfBlob(blobs[i], version, &decoded, err)) {
+            return false;
+        }
+
+        if (decoded.max_width != fnt->hdr->max_width || decoded.pix_height != fnt->hdr->pix_height) {
+            return err->Set("Verify: font %d header mismatch", i);
+        }
+
+        if (decoded.flags & DFBF_FLAG_PROPORTIONAL) {
+            for (int c = 0; c < 224; c++) {
+                if (decoded.widths[c] != fnt->glyphs[c].pix_width) {
+                    return err->Set("Verify: font %d width of glyph %d mismatch", i, c);
+                }
+            }
+        }
+
+        GlyphSheet *expected = UnpackGlyphsReference(fnt, arena);
+        bool same = true;
+        int y = 0;
+        for (; y < expected->height && same; y++) {
+            same = memcmp(expected->Row(y), decoded.sheet->Row(y), expected->stride * sizeof(u64)) == 0;
+        }
+
+        if (!same) {
+            return err->Set("Verify: font %d glyph data mismatch in row %d", i, y - 1);
+        }
+
+        // Version 1 glyphs can also be decoded one at a time. Check that
+        // gives the same as the cell in the whole sheet.
+        if (version >= 1) {
+            GlyphSheet glyph(decoded.max_width, decoded.pix_height);
+            for (int c = 0; c < 224; c++) {
+                if (!DecodeDfbfGlyph(blobs[i], c, &glyph, err)) {
+                    return false;
+                }
+                int x0 = (c % 16) * decoded.max_width;
+                int y0 = (c / 16) * decoded.pix_height;
+                for (int y = 0; y < decoded.pix_height; y++) {
+                    for (int x = 0; x < decoded.max_width; x++) {
+                        if (glyph.GetPix(x, y) != decoded.sheet->GetPix(x0 + x, y0 + y)) {
+                            return err->Set("Verify: font %d glyph %d mismatch", i, c);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// Counts the byte columns UnpackGlyphs() gathers, each of which was a seek
+// and read before the file was mapped.
+static int CountGlyphColumns(FullFnt *fnt) {
+    int num_columns = 0;
+    for (int i = 0; i < 224; i++) {
+        num_columns += (fnt->glyphs[i].pix_width + 7) / 8;
+    }
+    return num_columns;
+}
+
+
+// Unpacks and encodes one font into its blob. Each font only touches its
+// own FullFnt, blob, arena and metrics, so they can be encoded in parallel.
+static void EncodeFont(FullFnt *fnt, int font_index, const char *source, ConvertOptions const &opts,
+                       MemBuf *blob, Arena *arena, ConvertMetrics *metrics) {
+    blob->Reset();
+    WriteDfbfToMemBuf(blob, fnt, opts, arena, metrics);
+    blob->FlushNibble();
+
+    if (metrics) {
+        const FntHeader *hdr = fnt->hdr;
+        FontMetrics *font = &metrics->fonts.back();
+        font->path = source;
+        font->font_index = font_index;
+        font->max_width = hdr->max_width;
+        font->pix_height = hdr->pix_height;
+        font->flags = blob->data[2];
+        font->sheet_num_bytes = 16 * hdr->max_width * 14 * hdr->pix_height / 8;
+        font->blob_num_bytes = blob->data_num_bytes;
+        metrics->num_column_reads += CountGlyphColumns(fnt);
+    }
+}
+
+
+// Encodes the parsed fonts into ctx->font_blobs, verifies them if asked,
+// and builds the outputs in opts.outputs into ctx's buffers. source names
+// the input in the metrics.
+//
+// With a pool, the fonts are encoded as separate tasks, so that a family
+// of many sizes takes about as long as its largest size. Each font's blob
+// is the same as a serial run gives, and the outputs are built from them
+// in order afterwards, so the outputs are too.
+//
+// With ctx->font_cache, fonts whose blobs are already there aren't encoded
+// again, and the others are added once they are.
+static bool EncodeFonts(FullFnt **all_fnts, int num_fnts, const char *fnt_name, const char *source,
+                        ConvertOptions const &opts, ConvertContext *ctx, ConvertError *err) {
+    ConvertMetrics *metrics = ctx->metrics;
+    ctx->ReserveFonts(num_fnts);
+    MemBuf *const *font_blobs = &ctx->font_blobs[0];
+
+    u64 font_keys[MAX_FNTS_PER_FILE];
+    bool found[MAX_FNTS_PER_FILE] = { false };
+    int num_to_encode = num_fnts;
+    if (ctx->font_cache) {
+        StageTimer timer(metrics, STAGE_CACHE);
+        for (int i = 0; i < num_fnts; i++) {
+            font_keys[i] = ComputeFontKey(all_fnts[i], opts);
+            font_blobs[i]->Reset();
+            found[i] = ctx->font_cache->Find(font_keys[i], font_blobs[i]);
+            if (found[i]) {
+                num_to_encode--;
+            }
+        }
+    }
+    ctx->num_fnts_encoded = num_to_encode;
+
+    if (ctx->pool && num_to_encode > 1) {
+        // Tasks get their own metrics, merged in font order once all are done.
+        std::vector<ConvertMetrics> font_metrics(metrics ? num_fnts : 0);
+        TaskGroup group;
+        for (int i = 0; i < num_fnts; i++) {
+            if (found[i]) {
+                continue;
+            }
+            FullFnt *fnt = all_fnts[i];
+            MemBuf *blob = font_blobs[i];
+            Arena *arena = ctx->font_arenas[i];
+            ConvertMetrics *task_metrics = metrics ? &font_metrics[i] : NULL;
+            const ConvertOptions *task_opts = &opts;
+            ctx->pool->Push([fnt, i, source, task_opts, blob, arena, task_metrics](int) {
+                EncodeFont(fnt, i, source, *task_opts, blob, arena, task_metrics);
+            }, &group, ctx->worker_index);
+        }
+        ctx->pool->WaitForGroup(&group, ctx->worker_index);
+
+        for (unsigned i = 0; i < font_metrics.size(); i++) {
+            metrics->Merge(font_metrics[i]);
+        }
+    }
+    else {
+        for (int i = 0; i < num_fnts; i++) {
+            if (!found[i]) {
+                EncodeFont(all_fnts[i], i, source, opts, font_blobs[i], ctx->font_arenas[i], metrics);
+            }
+        }
+    }
+
+    if (ctx->font_cache) {
+        StageTimer timer(metrics, STAGE_CACHE);
+        for (int i = 0; i < num_fnts; i++) {
+            if (!found[i]) {
+                ctx->font_cache->Store(font_keys[i], font_blobs[i]);
+            }
+        }
+    }
+
+    if (opts.verify) {
+        StageTimer timer(metrics, STAGE_VERIFY);
+        ctx->dfbf.Reset();
+        BuildDfbf(&ctx->dfbf, opts.dfbf_version, font_blobs, num_fnts);
+        if (!VerifyDfbf(&ctx->dfbf, all_fnts, num_fnts, &ctx->arena, err)) {
+            return false;
+        }
+    }
+
+    ctx->cpp.Reset();
+    ctx->h.Reset();
+    ctx->dfbf.Reset();
+    if (opts.outputs & OUTPUT_CPP) {
+        StageTimer timer(metrics, STAGE_EMIT_C);
+        if (!BuildCSource(&ctx->cpp, fnt_name, all_fnts, font_blobs, num_fnts, opts, err)) {
+            return false;
+        }
+    }
+    if (opts.outputs & OUTPUT_H) {
+        StageTimer timer(metrics, STAGE_EMIT_C);
+        BuildCHeader(&ctx->h, fnt_name, all_fnts, font_blobs, num_fnts, opts);
+    }
+    if (opts.outputs & OUTPUT_DFBF) {
+        StageTimer timer(metrics, STAGE_EMIT_DFBF);
+        BuildDfbf(&ctx->dfbf, opts.dfbf_version, font_blobs, num_fnts);
+    }
+
+    return true;
+}
+
+
+// Frees everything the last conversion allocated from ctx's arenas.
+static void ResetArenas(ConvertContext *ctx) {
+    ctx->arena.Reset();
+    for (unsigned i = 0; i < ctx->font_arenas.size(); i++) {
+        ctx->font_arenas[i]->Reset();
+    }
+}
+
+
+// The .dfbf only has cells for chars 32 to 255, so a font's chars below 32
+// are dropped. Adds a warning to ctx for each font that has any.
+static void AddDroppedCharWarnings(FullFnt *const *fnts, int num_fnts, ConvertContext *ctx) {
+    for (int i = 0; i < num_fnts; i++) {
+        const FntHeader *hdr = fnts[i]->hdr;
+        if (hdr->first_char >= 32) {
+            continue;
+        }
+        int last_dropped = hdr->last_char < 31 ? hdr->last_char : 31;
+        ctx->warnings.push_back(ctx->arena.Printf(
+            "Font %d (%dx%d) has chars %d to %d, below the .dfbf's first char of 32. They are dropped.",
+            i, hdr->max_width, hdr->pix_height, hdr->first_char, last_dropped));
+    }
+}
+
+
+static bool ConvertMappedFile(const char *path, ByteView file, ConvertOptions const &opts,
+                              ConvertContext *ctx, ConvertError *err) {
+    ConvertMetrics *metrics = ctx->metrics;
+    FullFnt *all_fnts[MAX_FNTS_PER_FILE] = { NULL };
+    int num_fnts = 0;
+    bool ok;
+    {
+        StageTimer timer(metrics, STAGE_PARSE);
+        ok = ParseFon(file, all_fnts, &num_fnts, &ctx->arena, err);
+    }
+    if (ok) {
+        AddDroppedCharWarnings(all_fnts, num_fnts, ctx);
+    }
+
+    char *fnt_name = GetNameFromPath(path, &ctx->arena);
+    struct { int flag; MemBuf *buf; const char *extension; bool text; } artifacts[] = {
+        { OUTPUT_CPP, &ctx->cpp, ".cpp", true },
+        { OUTPUT_H, &ctx->h, ".h", true },
+        { OUTPUT_DFBF, &ctx->dfbf, ".dfbf", false }
+    };
+
+    // A cache hit needs every output that was asked for.
+    u64 cache_key = 0;
+    bool cached = false;
+    if (ok && opts.cache_dir) {
+        StageTimer timer(metrics, STAGE_CACHE);
+        cache_key = ComputeCacheKey(all_fnts, num_fnts, fnt_name, opts);
+        cached = true;
+        for (int i = 0; i < 3 && cached; i++) {
+            if (opts.outputs & artifacts[i].flag) {
+                artifacts[i].buf->Reset();
+                cached = ReadCacheEntry(opts.cache_dir, cache_key, artifacts[i].extension,
+                                        artifacts[i].buf, &ctx->arena);
+            }
+        }
+        if (cached && metrics) {
+            metrics->num_cache_hits++;
+        }
+    }
+
+    if (ok && !cached) {
+        ok = EncodeFonts(all_fnts, num_fnts, fnt_name, path, opts, ctx, err);
+
+        for (int i = 0; i < 3 && ok && opts.cache_dir; i++) {
+            if (opts.outputs & artifacts[i].flag) {
+                StageTimer timer(metrics, STAGE_CACHE);
+                WriteCacheEntry(opts.cache_dir, cache_key, artifacts[i].extension, artifacts[i].buf,
+                                &ctx->arena);
+            }
+        }
+    }
+
+    for (int i = 0; i < 3 && ok; i++) {
+        if (!(opts.outputs & artifacts[i].flag)) {
+            continue;
+        }
+
+        StageTimer timer(metrics, STAGE_WRITE);
+        char *out_path = NULL;
+        if (!opts.to_stdout) {
+            out_path = ctx->arena.Printf("%s/%s%s", opts.out_dir, fnt_name, artifacts[i].extension);
+        }
+        if (out_path) {
+            ok = ReplaceArtifact(out_path, artifacts[i].buf, artifacts[i].text, err);
+        }
+        else {
+            ok = WriteArtifact(NULL, artifacts[i].buf, artifacts[i].text, err);
+        }
+        if (ok && metrics) {
+            metrics->num_bytes_written += artifacts[i].buf->data_num_bytes;
+        }
+    }
+
+    ResetArenas(ctx);
+    return ok;
+}
+
+
+bool ConvertFile(const char *path, ConvertOptions const &opts, ConvertContext *ctx,
+                 ConvertError *err) {
+    ConvertMetrics *metrics = ctx->metrics;
+    ctx->num_fnts_encoded = 0;
+    ctx->warnings.clear();
+    if (metrics) {
+        metrics->num_files++;
+    }
+
+    MappedFile fon_file;
+    bool ok = opts.copy_input ? fon_file.Read(path) : fon_file.Open(path);
+    if (!ok) {
+        err->Set("Couldn't open file '%s'", path);
+    }
+    else {
+        if (metrics) {
+            metrics->num_bytes_read += fon_file.view.num_bytes;
+        }
+        ok = ConvertMappedFile(path, fon_file.view, opts, ctx, err);
+    }
+
+    if (!ok && metrics) {
+        metrics->num_failed++;
+    }
+    return ok;
+}
+
+
+bool ConvertFonBuffer(const void *fon, size_t num_bytes, const char *name,
+                      ConvertOptions const &opts, ConvertContext *ctx, ConvertResult *result,
+                      ConvertError *err) {
+    ConvertMetrics *metrics = ctx->metrics;
+    ctx->num_fnts_encoded = 0;
+    ctx->warnings.clear();
+    if (metrics) {
+        metrics->num_files++;
+        metrics->num_bytes_read += num_bytes;
+    }
+
+    FullFnt *all_fnts[MAX_FNTS_PER_FILE] = { NULL };
+    int num_fnts = 0;
+    bool ok;
+    {
+        StageTimer timer(metrics, STAGE_PARSE);
+        ok = ParseFon(ByteView((const u8 *)fon, num_bytes), all_fnts, &num_fnts, &ctx->arena, err);
+    }
+    if (ok) {
+        AddDroppedCharWarnings(all_fnts, num_fnts, ctx);
+    }
+
+    if (ok) {
+        ok = EncodeFonts(all_fnts, num_fnts, name, name, opts, ctx, err);
+    }
+
+    result->num_fnts = 0;
+    if (ok) {
+        result->num_fnts = num_fnts;
+        for (int i = 0; i < num_fnts; i++) {
+            ConvertedFont *font = &result->fnts[i];
+            font->max_width = all_fnts[i]->hdr->max_width;
+            font->pix_height = all_fnts[i]->hdr->pix_height;
+            font->proportional = all_fnts[i]->hdr->pix_width == 0;
+            font->blob = ByteView(ctx->font_blobs[i]->data, ctx->font_blobs[i]->data_num_bytes);
+        }
+        result->dfbf = ByteView(ctx->dfbf.data, ctx->dfbf.data_num_bytes);
+        result->cpp = ByteView(ctx->cpp.data, ctx->cpp.data_num_bytes);
+        result->h = ByteView(ctx->h.data, ctx->h.data_num_bytes);
+    }
+
+    ResetArenas(ctx);
+    if (!ok && metrics) {
+        metrics->num_failed++;
+    }
+    return ok;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "arena.h"
+#include "mapped_file.h"
+#include "mem_buf.h"
+#include "metrics.h"
+#include "windows_fnt.h"
+
+#include <string>
+#include <vector>
+
+
+struct FontBlobCache;
+struct GlyphSheet;
+struct ThreadPool;
+
+
+// Records why a conversion failed. Used instead of ReleaseAssert for
+// anything that depends on the input, so that one bad .fon doesn't take down
+// a whole batch run.
+struct ConvertError {
+    char msg[256];
+
+    ConvertError() {
+        msg[0] = '\0';
+    }
+
+    // Always returns false so that callers can "return err->Set(...);".
+    bool Set(const char *fmt, ...);
+};
+
+
+// A glyph of a FullFnt, from either a 2.0 or a 3.0 glyph table.
+struct FntGlyph {
+    int pix_width;                  // 0 if the font doesn't have the char.
+    size_t bitmap_offset;           // From the start of the FONT resource.
+};
+
+
+// The header and name point into the mapped .fon file. The FullFnt itself,
+// its glyphs and its sheet are allocated from an Arena, and freed with it.
+// hdr only covers the fields the 2.0 and 3.0 headers share.
+struct FullFnt {
+    ByteView resource;              // The whole FONT resource.
+    const FntHeader *hdr;
+    const FntGlyph *glyphs;         // 224 entries, one per cell. Cell c holds char 32 + c.
+    const char *name;
+    GlyphSheet *sheet;              // NULL until UnpackGlyphs().
+};
+
+
+// The .dfbf stores its font count in a byte.
+enum { MAX_FNTS_PER_FILE = 255 };
+
+
+// Fills in fnts[] from the FONT resources of a mapped .fon file. This only
+// reads and checks the headers. The glyphs aren't unpacked until they are
+// needed, so that a cache hit costs little more than hashing the resources.
+// The FullFnts are allocated from arena.
+bool ParseFon(ByteView file, FullFnt **fnts, int *num_fnts, Arena *arena, ConvertError *err);
+
+// Unpacks the glyphs into fnt->sheet, allocated from arena, if that hasn't
+// been done already.
+void UnpackGlyphs(FullFnt *fnt, Arena *arena);
+
+// Extracts "df_mono" from "c:/fonts/df_mono.fon", into a string allocated
+// from arena.
+char *GetNameFromPath(const char *path, Arena *arena);
+
+enum {
+    OUTPUT_CPP = 1,
+    OUTPUT_H = 2,
+    OUTPUT_DFBF = 4,
+    OUTPUT_ALL = OUTPUT_CPP | OUTPUT_H | OUTPUT_DFBF
+};
+
+// Bits of the flags byte in each .dfbf font blob.
+enum {
+    DFBF_FLAG_PROPORTIONAL = 1,     // A table of 224 glyph widths follows the flags.
+    DFBF_FLAG_WIDE_OFFSETS = 2,     // Version 1 glyph index entries are u32, not u16.
+    DFBF_FLAG_PREDICTOR = 0xc,      // Two bits holding the PREDICT_* value used.
+    DFBF_FLAG_BYTE_RUNS = 0x10,     // Each run is a byte, rather than a nibble with escapes.
+    DFBF_FLAG_HUFFMAN = 0x20,       // The nibble runs are Huffman coded. See huffman.h.
+    DFBF_FLAG_GLYPH_REFS = 0x40,    // Version 1 identical glyphs share their data.
+    DFBF_FLAG_PACKED = 0x80         // Version 1 glyphs only cover a rect of their cell.
+};
+
+enum { DFBF_PREDICTOR_SHIFT = 2 };
+
+enum {
+    CODEC_SMALLEST,                 // Try every predictor and run format, keep the smallest.
+    CODEC_CLASSIC                   // Up-prediction and nibble runs, as older decoders expect. The default.
+};
+
+// How the generated .cpp holds each font blob.
+enum {
+    C_DATA_ARRAY,                   // An array of words.
+    C_DATA_STRING                   // A string literal, which compiles faster.
+};
+
+// Which area of each glyph cell version 1 encodes.
+enum {
+    PACK_CELLS,                     // The whole max_width x pix_height cell.
+    PACK_WIDTH,                     // The glyph's pix_width columns.
+    PACK_INK                        // The bounding box of the glyph's set pixels.
+};
+
+
+struct ConvertOptions {
+    const char *out_dir;
+    int outputs;                    // OUTPUT_* flags.
+    bool to_stdout;                 // Write the outputs to stdout instead of out_dir.
+    bool verify;                    // Decode the .dfbf again and check it against the .fon.
+    int dfbf_version;               // 0 is one stream per font, 1 adds a per glyph index.
+    int codec;                      // CODEC_*.
+    bool huffman;                   // Also try Huffman coding the runs. Smaller, slower to decode.
+    int packing;                    // PACK_*. Version 1 only.
+    int c_data;                     // C_DATA_*.
+    bool c_decoded[256];            // By pix_height, the sizes the .cpp also holds decoded.
+    const char *cache_dir;          // Reuse earlier outputs kept here. NULL for no cache.
+    bool copy_input;                // Read the .fon into memory rather than map it. See MappedFile::Read().
+
+    ConvertOptions() {
+        out_dir = ".";
+        outputs = OUTPUT_ALL;
+        to_stdout = false;
+        verify = false;
+        dfbf_version = 0;
+        codec = CODEC_CLASSIC;
+        huffman = false;
+        packing = PACK_CELLS;
+        c_data = C_DATA_ARRAY;
+        memset(c_decoded, 0, sizeof(c_decoded));
+        cache_dir = NULL;
+        copy_input = false;
+    }
+};
+
+
+// Buffers that are reused from one conversion to the next, so that a batch
+// run's memory use stays flat. Each thread needs its own. Everything else a
+// conversion allocates comes from the arenas, which are reset when it ends.
+struct ConvertContext {
+    std::vector<MemBuf *> font_blobs;       // One per font of the biggest file converted so far.
+    MemBuf cpp;
+    MemBuf h;
+    MemBuf dfbf;
+    Arena arena;                    // The parsed fonts, paths and verify's sheets.
+    std::vector<Arena *> font_arenas;       // Each font's sheets and scratch, so fonts can be encoded in parallel.
+    ConvertMetrics *metrics;        // Stage times and counts are added here, if not NULL.
+    ThreadPool *pool;               // If not NULL, the fonts of a file are encoded in parallel.
+    int worker_index;               // Of the pool worker using this context, or -1.
+    FontBlobCache *font_cache;      // If not NULL, fonts already encoded are copied from here.
+    int num_fnts_encoded;           // By the last conversion, rather than copied from font_cache.
+    std::vector<std::string> warnings;      // What the last conversion couldn't keep, one per line.
+
+    ConvertContext() {
+        metrics = NULL;
+        pool = NULL;
+        worker_index = -1;
+        font_cache = NULL;
+        num_fnts_encoded = 0;
+    }
+
+    ~ConvertContext() {
+        for (unsigned i = 0; i < font_blobs.size(); i++) {
+            delete font_blobs[i];
+            delete font_arenas[i];
+        }
+    }
+
+    // Makes sure there is a blob and an arena for each of num_fnts fonts.
+    // They are only made when a file needs them, as most files have a few
+    // fonts but a file can have up to MAX_FNTS_PER_FILE.
+    void ReserveFonts(int num_fnts) {
+        while ((int)font_blobs.size() < num_fnts) {
+            font_blobs.push_back(new MemBuf);
+            font_arenas.push_back(new Arena);
+        }
+    }
+};
+
+
+// Encodes one font as a .dfbf font blob. The glyph sheet is modified. Its
+// working memory comes from arena. If metrics isn't NULL, the stage times
+// are added to it and a FontMetrics is appended with the run counts filled
+// in.
+void WriteDfbfToMemBuf(MemBuf *buf, FullFnt *fnt, ConvertOptions const &opts, Arena *arena,
+                       ConvertMetrics *metrics);
+
+// Converts one .fon into <out_dir>/<name>.cpp, .h and .dfbf. Each output
+// is written under a temporary name and renamed into place. With a
+// cache_dir, the outputs are copied from there if they are already cached,
+// and stored there if not.
+bool ConvertFile(const char *path, ConvertOptions const &opts, ConvertContext *ctx,
+                 ConvertError *err);
+
+
+// The library interface, for tools that want to convert fonts in-process.
+// Everything stays in memory: the .fon is passed in as a buffer, and the
+// results point into ctx's buffers. There are no globals, no file I/O and
+// nothing exits the process on bad input, so conversions can run on several
+// threads at once, each with its own ConvertContext. opts.out_dir,
+// to_stdout and cache_dir are ignored.
+
+struct ConvertedFont {
+    int max_width;
+    int pix_height;
+    bool proportional;
+    ByteView blob;                  // The font's .dfbf blob. See WriteDfbfToMemBuf().
+};
+
+// The views are valid until ctx is next used or destroyed.
+struct ConvertResult {
+    int num_fnts;
+    ConvertedFont fnts[MAX_FNTS_PER_FILE];
+    ByteView dfbf;                  // Each output is empty unless it is in opts.outputs.
+    ByteView cpp;
+    ByteView h;
+};
+
+// name is used for the identifiers in the .cpp and .h, like the file name
+// is by ConvertFile(). Like it, this leaves anything the conversion couldn't
+// keep, such as chars below 32, in ctx->warnings.
+bool ConvertFonBuffer(const void *fon, size_t num_bytes, const char *name,
+                      ConvertOptions const &opts, ConvertContext *ctx, ConvertResult *result,
+                      ConvertError *err);
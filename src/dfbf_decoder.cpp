@@ -0,0 +1,444 @@
+#include "dfbf_decoder.h"
+#include "arena.h"
+#include "huffman.h"
+#include "predictor.h"
+
+#include <string.h>
+
+
+// For each byte of the nibble stream, the two nibbles as run lengths, and
+// whether both are plain runs. When they are, which is the common case, a
+// whole byte is decoded with one lookup. Otherwise one of them starts an
+// escape and the slow path takes over.
+struct NibblePairTable {
+    u8 first[256];
+    u8 second[256];
+    bool two_runs[256];
+
+    NibblePairTable() {
+        for (int i = 0; i < 256; i++) {
+            first[i] = i & 0xf;
+            second[i] = i >> 4;
+            two_runs[i] = first[i] != 0 && second[i] != 0;
+        }
+    }
+};
+
+static const NibblePairTable s_nibble_pairs;
+
+
+// Sets bits [x0, x1) of a row. Whole words in the middle are done with memset.
+static void FillRow(u64 *row, int x0, int x1) {
+    int first_word = x0 >> 6;
+    int last_word = (x1 - 1) >> 6;
+    u64 first_mask = ~0ULL << (x0 & 63);
+    u64 last_mask = ~0ULL >> (63 - ((x1 - 1) & 63));
+
+    if (first_word == last_word) {
+        row[first_word] |= first_mask & last_mask;
+        return;
+    }
+
+    row[first_word] |= first_mask;
+    if (last_word - first_word > 1) {
+        memset(row + first_word + 1, 0xff, (last_word - first_word - 1) * sizeof(u64));
+    }
+    row[last_word] |= last_mask;
+}
+
+
+// Keeps track of where the next run goes in the sheet. Runs flow from the
+// end of one row onto the start of the next.
+struct RunWriter {
+    GlyphSheet *sheet;
+    int x;
+    int y;
+    int colour;
+
+    RunWriter(GlyphSheet *_sheet) {
+        sheet = _sheet;
+        x = 0;
+        y = 0;
+        colour = 0;
+    }
+
+    // Returns false if the run goes past the end of the sheet.
+    bool AddRun(int run_len) {
+        if (colour) {
+            while (run_len > 0) {
+                if (y >= sheet->height) {
+                    return false;
+                }
+                int len = sheet->width - x;
+                if (len > run_len) {
+                    len = run_len;
+                }
+                FillRow(sheet->Row(y), x, x + len);
+                Advance(len);
+                run_len -= len;
+            }
+        }
+        else {
+            // The sheet starts cleared, so 0 runs only need to move along.
+            long long pos = (long long)y * sheet->width + x + run_len;
+            if (pos > (long long)sheet->width * sheet->height) {
+                return false;
+            }
+            y = (int)(pos / sheet->width);
+            x = (int)(pos % sheet->width);
+        }
+
+        colour ^= 1;
+        return true;
+    }
+
+    void Advance(int len) {
+        x += len;
+        if (x == sheet->width) {
+            x = 0;
+            y++;
+        }
+    }
+
+    // The encoder doesn't write the last run. It fills the rest of the sheet.
+    void Finish() {
+        if (colour && y < sheet->height) {
+            AddRun((sheet->height - y) * sheet->width - x);
+        }
+    }
+};
+
+
+static bool DecodeNibbleRuns(const u8 *data, int num_bytes, GlyphSheet *sheet, ConvertError *err) {
+    RunWriter writer(sheet);
+    int num_nibbles = num_bytes * 2;
+    int i = 0;
+
+    while (i < num_nibbles) {
+        // Fast path: a byte holding two plain runs.
+        if ((i & 1) == 0) {
+            u8 the_byte = data[i >> 1];
+            if (s_nibble_pairs.two_runs[the_byte]) {
+                if (!writer.AddRun(s_nibble_pairs.first[the_byte]) ||
+                    !writer.AddRun(s_nibble_pairs.second[the_byte])) {
+                    return err->Set("Run past the end of the glyph sheet");
+                }
+                i += 2;
+                continue;
+            }
+        }
+
+        int run_len = (data[i >> 1] >> ((i & 1) * 4)) & 0xf;
+        i++;
+        if (run_len == 0) {
+            // An escape needs two more nibbles for the 8-bit length. If they
+            // aren't there, this was the zero nibble padding the last byte.
+            if (i + 2 > num_nibbles) {
+                break;
+            }
+            int lo = (data[i >> 1] >> ((i & 1) * 4)) & 0xf;
+            i++;
+            int hi = (data[i >> 1] >> ((i & 1) * 4)) & 0xf;
+            i++;
+            run_len = lo | (hi << 4);
+        }
+
+        if (!writer.AddRun(run_len)) {
+            return err->Set("Run past the end of the glyph sheet");
+        }
+    }
+
+    writer.Finish();
+    return true;
+}
+
+
+static bool DecodeByteRuns(const u8 *data, int num_bytes, GlyphSheet *sheet, ConvertError *err) {
+    RunWriter writer(sheet);
+    for (int i = 0; i < num_bytes; i++) {
+        if (!writer.AddRun(data[i])) {
+            return err->Set("Run past the end of the glyph sheet");
+        }
+    }
+
+    writer.Finish();
+    return true;
+}
+
+
+// Decodes the runs in the format flags says, then undoes the prediction,
+// which may take scratch memory from arena.
+static bool DecodeSheet(const u8 *data, int num_bytes, int flags, int cell_width,
+                        GlyphSheet *sheet, Arena *arena, ConvertError *err) {
+    bool ok;
+    if (flags & DFBF_FLAG_HUFFMAN) {
+        MemBuf nibbles;
+        ok = HuffmanDecodeNibbles(ByteView(data, num_bytes), &nibbles, err);
+        nibbles.FlushNibble();
+        ok = ok && DecodeNibbleRuns(nibbles.data, nibbles.data_num_bytes, sheet, err);
+    }
+    else if (flags & DFBF_FLAG_BYTE_RUNS) {
+        ok = DecodeByteRuns(data, num_bytes, sheet, err);
+    }
+    else {
+        ok = DecodeNibbleRuns(data, num_bytes, sheet, err);
+    }
+    if (!ok) {
+        return false;
+    }
+
+    int predictor = (flags & DFBF_FLAG_PREDICTOR) >> DFBF_PREDICTOR_SHIFT;
+    UndoPredictor(sheet, predictor, cell_width, arena);
+    return true;
+}
+
+
+bool SplitDfbfFile(ByteView file, ByteView *blobs, int max_blobs, int *num_blobs, int *version,
+                   ConvertError *err) {
+    const u8 *hdr = file.Get<u8>(0, 6);
+    if (!hdr || memcmp(hdr, "dfbf", 4) != 0) {
+        return err->Set("Not a .dfbf file");
+    }
+    if (hdr[4] > 1) {
+        return err->Set("Unsupported .dfbf version %d", hdr[4]);
+    }
+    *version = hdr[4];
+
+    int num_fnts = hdr[5];
+    if (num_fnts > max_blobs) {
+        return err->Set("Too many fonts in .dfbf (%d)", num_fnts);
+    }
+
+    const u8 *offsets = file.Get<u8>(6, num_fnts * 4);
+    if (!offsets) {
+        return err->Set(".dfbf offset table is truncated");
+    }
+
+    // Fonts whose blobs are identical share one copy, so offsets can
+    // repeat. Each blob ends at the next higher offset, or the end of the file.
+    for (int i = 0; i < num_fnts; i++) {
+        u32 start;
+        memcpy(&start, offsets + i * 4, 4);
+        u32 end = (u32)file.num_bytes;
+        for (int j = 0; j < num_fnts; j++) {
+            u32 other;
+            memcpy(&other, offsets + j * 4, 4);
+            if (other > start && other < end) {
+                end = other;
+            }
+        }
+        if (start > end) {
+            return err->Set("Bad offset for font %d in .dfbf", i);
+        }
+        blobs[i] = file.Sub(start, end - start);
+    }
+
+    *num_blobs = num_fnts;
+    return true;
+}
+
+
+// Reads the header bytes and optional width table common to both versions.
+// Returns the offset of what follows in *offset.
+static bool ReadBlobHeader(ByteView blob, DecodedFont *font, size_t *offset, ConvertError *err) {
+    const u8 *hdr = blob.Get<u8>(0, 3);
+    if (!hdr) {
+        return err->Set("Font blob is truncated");
+    }
+
+    font->max_width = hdr[0];
+    font->pix_height = hdr[1];
+    font->flags = hdr[2];
+    *offset = 3;
+
+    memset(font->widths, 0, sizeof(font->widths));
+    if (font->flags & DFBF_FLAG_PROPORTIONAL) {
+        const u8 *widths = blob.Get<u8>(*offset, 224);
+        if (!widths) {
+            return err->Set("Font blob width table is truncated");
+        }
+        memcpy(font->widths, widths, 224);
+        *offset += 224;
+    }
+
+    return true;
+}
+
+
+// The index of a version 1 blob. Without DFBF_FLAG_GLYPH_REFS every glyph
+// has its own bitmap, numbered the same as the glyph.
+struct GlyphIndex {
+    const u8 *refs;                 // Which bitmap each glyph uses, or NULL.
+    const u8 *offsets;
+    int num_bitmaps;
+    int entry_size;
+    size_t data_offset;
+
+    int BitmapOf(int c) const {
+        return refs ? refs[c] : c;
+    }
+};
+
+
+static bool ReadGlyphIndex(ByteView blob, int flags, size_t offset, GlyphIndex *index,
+                           ConvertError *err) {
+    index->refs = NULL;
+    index->num_bitmaps = 224;
+    if (flags & DFBF_FLAG_GLYPH_REFS) {
+        const u8 *refs = blob.Get<u8>(offset, 1 + 224);
+        if (!refs) {
+            return err->Set("Font blob glyph reference table is truncated");
+        }
+        // Decoding indexes per bitmap arrays with a glyph's ref, so the
+        // count must be one a real index can have.
+        index->num_bitmaps = refs[0];
+        if (index->num_bitmaps == 0 || index->num_bitmaps > 224) {
+            return err->Set("Font blob has %d glyph bitmaps. Must be 1 to 224.", index->num_bitmaps);
+        }
+        index->refs = refs + 1;
+        for (int c = 0; c < 224; c++) {
+            if (index->refs[c] >= index->num_bitmaps) {
+                return err->Set("Glyph %d uses bitmap %d of %d", c, index->refs[c], index->num_bitmaps);
+            }
+        }
+        offset += 1 + 224;
+    }
+
+    index->entry_size = (flags & DFBF_FLAG_WIDE_OFFSETS) ? 4 : 2;
+    index->offsets = blob.Get<u8>(offset, (index->num_bitmaps + 1) * index->entry_size);
+    if (!index->offsets) {
+        return err->Set("Font blob glyph index is truncated");
+    }
+    index->data_offset = offset + (index->num_bitmaps + 1) * index->entry_size;
+    return true;
+}
+
+
+// Finds bitmap u's run data.
+static bool FindBitmapData(ByteView blob, GlyphIndex const &index, int u, ByteView *data,
+                           ConvertError *err) {
+    u32 start = 0, end = 0;
+    memcpy(&start, index.offsets + u * index.entry_size, index.entry_size);
+    memcpy(&end, index.offsets + (u + 1) * index.entry_size, index.entry_size);
+
+    if (end < start || index.data_offset + end > blob.num_bytes) {
+        return err->Set("Bad index entry for glyph bitmap %d", u);
+    }
+    *data = blob.Sub(index.data_offset + start, end - start);
+    return true;
+}
+
+
+static bool DecodeGlyphCell(ByteView glyph_data, int flags, GlyphSheet *cell, Arena *arena,
+                            ConvertError *err) {
+    memset(cell->bits, 0, cell->stride * cell->height * sizeof(u64));
+    if (!(flags & DFBF_FLAG_PACKED)) {
+        if (cell->width == 0 || cell->height == 0) {
+            return true;
+        }
+        return DecodeSheet(glyph_data.data, (int)glyph_data.num_bytes, flags, cell->width, cell, arena,
+                           err);
+    }
+
+    // A packed bitmap only covers a rect of the cell.
+    const u8 *rect = glyph_data.Get<u8>(0, 4);
+    if (!rect) {
+        return err->Set("Packed glyph bitmap is truncated");
+    }
+    if (rect[0] + rect[2] > cell->width || rect[1] + rect[3] > cell->height) {
+        return err->Set("Packed glyph bitmap is outside its cell");
+    }
+    if (rect[2] == 0 || rect[3] == 0) {
+        return true;
+    }
+
+    GlyphSheet area(rect[2], rect[3]);
+    if (!DecodeSheet(glyph_data.data + 4, (int)glyph_data.num_bytes - 4, flags, area.width, &area, arena,
+                     err)) {
+        return false;
+    }
+    for (int y = 0; y < area.height; y++) {
+        CopyBits(cell->Row(rect[1] + y), rect[0], area.Row(y), 0, area.width);
+    }
+    return true;
+}
+
+
+bool DecodeDfbfBlob(ByteView blob, int version, DecodedFont *font, ConvertError *err) {
+    size_t offset;
+    if (!ReadBlobHeader(blob, font, &offset, err)) {
+        return false;
+    }
+
+    delete font->sheet;
+    font->sheet = new GlyphSheet(16 * font->max_width, 14 * font->pix_height);
+    GlyphSheet *sheet = font->sheet;
+    if (sheet->width == 0 || sheet->height == 0) {
+        return true;
+    }
+
+    Arena arena;
+    if (version == 0) {
+        return DecodeSheet(blob.data + offset, (int)(blob.num_bytes - offset), font->flags,
+                           font->max_width, sheet, &arena, err);
+    }
+
+    GlyphIndex index;
+    if (!ReadGlyphIndex(blob, font->flags, offset, &index, err)) {
+        return false;
+    }
+
+    // Each bitmap is only decoded for the first glyph that uses it. Later
+    // ones copy that glyph's cell.
+    int first_use[224];
+    memset(first_use, 0xff, sizeof(first_use));
+    GlyphSheet cell(font->max_width, font->pix_height);
+    for (int c = 0; c < 224; c++) {
+        int x0 = (c % 16) * font->max_width;
+        int y0 = (c / 16) * font->pix_height;
+        int u = index.BitmapOf(c);
+        if (first_use[u] >= 0) {
+            int src_x0 = (first_use[u] % 16) * font->max_width;
+            int src_y0 = (first_use[u] / 16) * font->pix_height;
+            for (int y = 0; y < font->pix_height; y++) {
+                CopyBits(sheet->Row(y0 + y), x0, sheet->Row(src_y0 + y), src_x0, font->max_width);
+            }
+            continue;
+        }
+        first_use[u] = c;
+
+        ByteView glyph_data;
+        if (!FindBitmapData(blob, index, u, &glyph_data, err) ||
+            !DecodeGlyphCell(glyph_data, font->flags, &cell, &arena, err)) {
+            return false;
+        }
+        for (int y = 0; y < font->pix_height; y++) {
+            CopyBits(sheet->Row(y0 + y), x0, cell.Row(y), 0, font->max_width);
+        }
+    }
+
+    return true;
+}
+
+
+bool DecodeDfbfGlyph(ByteView blob, int c, GlyphSheet *glyph, ConvertError *err) {
+    DecodedFont font;
+    size_t offset;
+    if (!ReadBlobHeader(blob, &font, &offset, err)) {
+        return false;
+    }
+    if (c < 0 || c >= 224) {
+        return err->Set("Glyph %d out of range", c);
+    }
+    if (glyph->width != font.max_width || glyph->height != font.pix_height) {
+        return err->Set("Glyph sheet is %dx%d, font cells are %dx%d", glyph->width,
+                        glyph->height, font.max_width, font.pix_height);
+    }
+
+    GlyphIndex index;
+    ByteView glyph_data;
+    Arena arena;
+    return ReadGlyphIndex(blob, font.flags, offset, &index, err) &&
+           FindBitmapData(blob, index, index.BitmapOf(c), &glyph_data, err) &&
+           DecodeGlyphCell(glyph_data, font.flags, glyph, &arena, err);
+}
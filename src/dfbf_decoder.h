@@ -0,0 +1,41 @@
+#pragma once
+
+#include "converter.h"
+#include "glyph_sheet.h"
+
+
+// A font decoded back out of a .dfbf blob. The glyphs are laid out as
+// written: a grid of 16 x 14 cells, each max_width x pix_height.
+struct DecodedFont {
+    int max_width;
+    int pix_height;
+    int flags;                      // DFBF_FLAG_* bits.
+    u8 widths[224];                 // Only filled in if proportional.
+    GlyphSheet *sheet;
+
+    DecodedFont() {
+        sheet = NULL;
+    }
+
+    ~DecodedFont() {
+        delete sheet;
+    }
+};
+
+
+// Splits a whole .dfbf file into one view per font blob. Each blob runs up
+// to the start of the next, or to the end of the file. Fonts with
+// identical blobs get the same view. *version is the
+// format version from the file header, which the blobs are decoded with.
+bool SplitDfbfFile(ByteView file, ByteView *blobs, int max_blobs, int *num_blobs, int *version,
+                   ConvertError *err);
+
+// Decodes one font blob: the header bytes, the optional width table, then
+// the glyph sheet. In version 0 the sheet is one run length encoded,
+// predicted stream. In version 1 it is an index followed by each glyph cell
+// encoded on its own. The flags say which predictor and run format.
+bool DecodeDfbfBlob(ByteView blob, int version, DecodedFont *font, ConvertError *err);
+
+// Decodes just glyph c of a version 1 font blob, without touching the rest.
+// glyph must be max_width x pix_height.
+bool DecodeDfbfGlyph(ByteView blob, int c, GlyphSheet *glyph, ConvertError *err);
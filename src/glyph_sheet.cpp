@@ -0,0 +1,119 @@
+#include "glyph_sheet.h"
+
+#include "arena.h"
+
+#include <string.h>
+
+
+static int GetStride(int width) {
+    int stride = (width + 63) / 64;
+    if (stride == 0) {
+        stride = 1;
+    }
+    return stride;
+}
+
+
+GlyphSheet::GlyphSheet(int _width, int _height) {
+    width = _width;
+    height = _height;
+    stride = GetStride(width);
+    bits = new u64[stride * height];
+    owns_bits = true;
+    memset(bits, 0, stride * height * sizeof(u64));
+}
+
+
+GlyphSheet::GlyphSheet(int _width, int _height, Arena *arena) {
+    width = _width;
+    height = _height;
+    stride = GetStride(width);
+    bits = arena->New<u64>(stride * height);
+    owns_bits = false;
+}
+
+
+GlyphSheet::~GlyphSheet() {
+    if (owns_bits) {
+        delete [] bits;
+    }
+}
+
+
+void GlyphSheet::OrByte(int x, int y, u8 pixels) {
+    OrByteIntoRow(Row(y), width, x, pixels);
+}
+
+
+void OrByteIntoRow(u64 *row, int width, int x, u8 pixels) {
+    OrBitsIntoRow(row, width, x, pixels, 8);
+}
+
+
+void OrBitsIntoRow(u64 *row, int width, int x, u64 pixels, int num_bits) {
+    if (x >= width || pixels == 0) {
+        return;
+    }
+
+    if (width - x < num_bits) {
+        pixels &= (1ULL << (width - x)) - 1;
+    }
+
+    int shift = x & 63;
+    row[x >> 6] |= pixels << shift;
+    if (shift > 64 - num_bits) {
+        // Only non-zero if the pixels reach the next word, which the clipping
+        // above guarantees exists.
+        u64 high = pixels >> (64 - shift);
+        if (high) {
+            row[(x >> 6) + 1] |= high;
+        }
+    }
+}
+
+
+void SetBitRange(u64 *row, int x0, int x1) {
+    while (x0 < x1) {
+        int shift = x0 & 63;
+        int num_bits = 64 - shift;
+        if (num_bits > x1 - x0) {
+            num_bits = x1 - x0;
+        }
+        u64 mask = num_bits == 64 ? ~0ULL : ((1ULL << num_bits) - 1) << shift;
+        row[x0 >> 6] |= mask;
+        x0 += num_bits;
+    }
+}
+
+
+u64 GetBits(const u64 *row, int x, int num_bits) {
+    int word = x >> 6;
+    int shift = x & 63;
+    u64 bits = row[word] >> shift;
+    if (shift + num_bits > 64) {
+        bits |= row[word + 1] << (64 - shift);
+    }
+    if (num_bits < 64) {
+        bits &= (1ULL << num_bits) - 1;
+    }
+    return bits;
+}
+
+
+void CopyBits(u64 *dst_row, int dst_x, const u64 *src_row, int src_x, int num_bits) {
+    while (num_bits > 0) {
+        int n = num_bits < 64 ? num_bits : 64;
+        u64 bits = GetBits(src_row, src_x, n);
+
+        int word = dst_x >> 6;
+        int shift = dst_x & 63;
+        dst_row[word] |= bits << shift;
+        if (shift + n > 64) {
+            dst_row[word + 1] |= bits >> (64 - shift);
+        }
+
+        src_x += n;
+        dst_x += n;
+        num_bits -= n;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "windows_fnt.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+struct Arena;
+
+
+// A 1 bit per pixel bitmap holding a font's glyphs laid out in a grid. Rows
+// are stored top to bottom, each a whole number of u64 words. Pixel x of a
+// row is bit x % 64 of word x / 64, so the leftmost pixel is the least
+// significant bit. Bits past width are always 0.
+struct GlyphSheet {
+    int width;
+    int height;
+    int stride;                     // Words per row.
+    u64 *bits;
+    bool owns_bits;                 // False if bits came from an Arena.
+
+    GlyphSheet(int _width, int _height);
+    GlyphSheet(int _width, int _height, Arena *arena);
+    ~GlyphSheet();
+
+    u64 *Row(int y) { return bits + y * stride; }
+    const u64 *Row(int y) const { return bits + y * stride; }
+
+    int GetPix(int x, int y) const {
+        return (Row(y)[x >> 6] >> (x & 63)) & 1;
+    }
+
+    void PutPix(int x, int y, int val) {
+        u64 bit = 1ULL << (x & 63);
+        if (val) {
+            Row(y)[x >> 6] |= bit;
+        }
+        else {
+            Row(y)[x >> 6] &= ~bit;
+        }
+    }
+
+    // ORs 8 pixels, leftmost in the least significant bit, into row y
+    // starting at x. Pixels that fall past the right edge are dropped.
+    void OrByte(int x, int y, u8 pixels);
+};
+
+
+// GlyphSheet::OrByte() for a row that isn't part of a sheet. width is the
+// row's width in pixels.
+void OrByteIntoRow(u64 *row, int width, int x, u8 pixels);
+
+// Like OrByteIntoRow(), for num_bits (at most 56) pixels at once. pixels
+// must have no bits set above num_bits.
+void OrBitsIntoRow(u64 *row, int width, int x, u64 pixels, int num_bits);
+
+// Sets bits [x0, x1) of a row.
+void SetBitRange(u64 *row, int x0, int x1);
+
+// Returns num_bits (at most 64) pixels of a row starting at x, with pixel x
+// in the least significant bit. The pixels must be inside the row.
+u64 GetBits(const u64 *row, int x, int num_bits);
+
+// ORs num_bits pixels from src_row, starting at src_x, into dst_row at dst_x.
+void CopyBits(u64 *dst_row, int dst_x, const u64 *src_row, int src_x, int num_bits);
+
+// Index of the lowest set bit. x must not be 0.
+inline int CountTrailingZeros(u64 x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (u32)x)) {
+        return index;
+    }
+    _BitScanForward(&index, (u32)(x >> 32));
+    return index + 32;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
@@ -0,0 +1,215 @@
+#include "huffman.h"
+
+#include <string.h>
+
+
+// Works out Huffman code lengths for the 16 symbols. Two lowest weight
+// nodes are merged at a time, which is plenty fast for 16 symbols. If a
+// code comes out longer than the limit, the counts are flattened and it is
+// tried again.
+static void BuildCodeLengths(const int *counts, u8 *lengths) {
+    int weights[16];
+    memcpy(weights, counts, sizeof(weights));
+
+    while (1) {
+        int node_weight[32];
+        int parent[32];
+        int num_nodes = 0;
+        int leaf_node[16];
+        for (int i = 0; i < 16; i++) {
+            leaf_node[i] = -1;
+            if (weights[i] > 0) {
+                leaf_node[i] = num_nodes;
+                node_weight[num_nodes] = weights[i];
+                parent[num_nodes] = -1;
+                num_nodes++;
+            }
+        }
+
+        memset(lengths, 0, 16);
+        if (num_nodes == 0) {
+            return;
+        }
+        if (num_nodes == 1) {
+            for (int i = 0; i < 16; i++) {
+                if (leaf_node[i] >= 0) {
+                    lengths[i] = 1;
+                }
+            }
+            return;
+        }
+
+        int num_roots = num_nodes;
+        while (num_roots > 1) {
+            int a = -1, b = -1;
+            for (int i = 0; i < num_nodes; i++) {
+                if (parent[i] != -1) {
+                    continue;
+                }
+                if (a < 0 || node_weight[i] < node_weight[a]) {
+                    b = a;
+                    a = i;
+                }
+                else if (b < 0 || node_weight[i] < node_weight[b]) {
+                    b = i;
+                }
+            }
+            node_weight[num_nodes] = node_weight[a] + node_weight[b];
+            parent[num_nodes] = -1;
+            parent[a] = num_nodes;
+            parent[b] = num_nodes;
+            num_nodes++;
+            num_roots--;
+        }
+
+        int max_len = 0;
+        for (int i = 0; i < 16; i++) {
+            if (leaf_node[i] < 0) {
+                continue;
+            }
+            int len = 0;
+            for (int n = leaf_node[i]; parent[n] != -1; n = parent[n]) {
+                len++;
+            }
+            lengths[i] = len;
+            if (len > max_len) {
+                max_len = len;
+            }
+        }
+
+        if (max_len <= HUFFMAN_MAX_CODE_LEN) {
+            return;
+        }
+        for (int i = 0; i < 16; i++) {
+            if (weights[i] > 0) {
+                weights[i] = (weights[i] + 1) / 2;
+            }
+        }
+    }
+}
+
+
+// Assigns canonical codes: shorter codes first, and symbol order within a
+// length. The codes are bit reversed, because the stream is read least
+// significant bit first.
+static void BuildCodes(const u8 *lengths, u16 *codes) {
+    int code = 0;
+    for (int len = 1; len <= HUFFMAN_MAX_CODE_LEN; len++) {
+        for (int i = 0; i < 16; i++) {
+            if (lengths[i] != len) {
+                continue;
+            }
+            int reversed = 0;
+            for (int bit = 0; bit < len; bit++) {
+                reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+            }
+            codes[i] = reversed;
+            code++;
+        }
+        code <<= 1;
+    }
+}
+
+
+void HuffmanEncodeNibbles(MemBuf *out, const u8 *nibbles, int num_nibbles) {
+    int counts[16] = { 0 };
+    for (int i = 0; i < num_nibbles; i++) {
+        counts[(nibbles[i >> 1] >> ((i & 1) * 4)) & 0xf]++;
+    }
+
+    u8 lengths[16];
+    u16 codes[16];
+    BuildCodeLengths(counts, lengths);
+    BuildCodes(lengths, codes);
+
+    for (int i = 0; i < 16; i += 2) {
+        out->PushByte(lengths[i] | (lengths[i + 1] << 4));
+    }
+    u32 count = num_nibbles;
+    out->PushBytes(&count, 4);
+
+    u64 bit_buf = 0;
+    int num_bits = 0;
+    for (int i = 0; i < num_nibbles; i++) {
+        int symbol = (nibbles[i >> 1] >> ((i & 1) * 4)) & 0xf;
+        bit_buf |= (u64)codes[symbol] << num_bits;
+        num_bits += lengths[symbol];
+        while (num_bits >= 8) {
+            out->PushByte(bit_buf & 0xff);
+            bit_buf >>= 8;
+            num_bits -= 8;
+        }
+    }
+    if (num_bits > 0) {
+        out->PushByte(bit_buf & 0xff);
+    }
+}
+
+
+bool HuffmanDecodeNibbles(ByteView data, MemBuf *out, ConvertError *err) {
+    const u8 *hdr = data.Get<u8>(0, 12);
+    if (!hdr) {
+        return err->Set("Huffman table is truncated");
+    }
+
+    u8 lengths[16];
+    for (int i = 0; i < 16; i++) {
+        lengths[i] = (hdr[i >> 1] >> ((i & 1) * 4)) & 0xf;
+        if (lengths[i] > HUFFMAN_MAX_CODE_LEN) {
+            return err->Set("Bad Huffman code length");
+        }
+    }
+    u32 num_nibbles;
+    memcpy(&num_nibbles, hdr + 8, 4);
+
+    // Each entry of the lookup table is indexed by the next
+    // HUFFMAN_MAX_CODE_LEN bits of the stream. It holds the symbol whose
+    // code those bits start with in the low nibble, and the code length in
+    // the high nibble. 0 means no code matches.
+    u16 codes[16];
+    BuildCodes(lengths, codes);
+    u8 table[1 << HUFFMAN_MAX_CODE_LEN];
+    memset(table, 0, sizeof(table));
+    for (int i = 0; i < 16; i++) {
+        int len = lengths[i];
+        if (len == 0) {
+            continue;
+        }
+        for (int fill = codes[i]; fill < (1 << HUFFMAN_MAX_CODE_LEN); fill += 1 << len) {
+            table[fill] = i | (len << 4);
+        }
+    }
+
+    const u8 *bits = data.data + 12;
+    size_t num_bytes = data.num_bytes - 12;
+    size_t pos = 0;
+    u64 bit_buf = 0;
+    int num_bits = 0;
+    u64 packed = 0;
+    int num_packed = 0;
+    for (u32 i = 0; i < num_nibbles; i++) {
+        while (num_bits <= 56 && pos < num_bytes) {
+            bit_buf |= (u64)bits[pos++] << num_bits;
+            num_bits += 8;
+        }
+
+        int entry = table[bit_buf & ((1 << HUFFMAN_MAX_CODE_LEN) - 1)];
+        int len = entry >> 4;
+        if (len == 0 || len > num_bits) {
+            return err->Set("Bad Huffman code at nibble %u", i);
+        }
+        bit_buf >>= len;
+        num_bits -= len;
+
+        packed |= (u64)(entry & 0xf) << (num_packed * 4);
+        num_packed++;
+        if (num_packed == 16) {
+            out->PushNibbles(packed, 16);
+            packed = 0;
+            num_packed = 0;
+        }
+    }
+    out->PushNibbles(packed, num_packed);
+
+    return true;
+}
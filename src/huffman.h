@@ -0,0 +1,21 @@
+#pragma once
+
+#include "converter.h"
+
+
+// A static Huffman code over the 16 nibble values of a run length encoded
+// glyph stream. Run lengths are heavily skewed towards a few small values,
+// so this shrinks the stream a lot, at the cost of slower decoding.
+//
+// The coded form is:
+//
+//     8 bytes     Code length of each nibble value, 0 to 11, low nibble first.
+//     u32         Number of nibbles.
+//     ...         The codes, packed least significant bit first.
+
+enum { HUFFMAN_MAX_CODE_LEN = 11 };
+
+void HuffmanEncodeNibbles(MemBuf *out, const u8 *nibbles, int num_nibbles);
+
+// Decodes back into packed nibbles, appended to out.
+bool HuffmanDecodeNibbles(ByteView data, MemBuf *out, ConvertError *err);
@@ -1,478 +1,372 @@
-#include "windows_fnt.h"
+#include "batch.h"
+#include "benchmark.h"
+#include "converter.h"
+#include "glyph_sheet.h"
+#include "thread_pool.h"
+#include "watch.h"
+
+#include "df_bitmap.h"
 
 #include "df_font.h"
+#include "df_time.h"
 #include "df_window.h"
 
-#include <assert.h>
-#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <vector>
-
-
-DfColour g_colourRed = Colour(244, 0, 0);
-
-
-struct FullFnt {
-    FntHeader hdr;
-    _Glyph *glyph_table;           // Num entries is hdr.last_char - hdr.first_char + 2.
-    char name[128];
-    DfBitmap *bmp;
-};
-
-
-struct MemBuf {
-    int max_len;
-    u8 *data;
-    int data_num_bytes;
-    int hi_nibble_next;
-    int output_byte;
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+
+static void PrintUsage(const char *exe_name) {
+    printf("Usage: %s [options] <your.fon|dir> [more.fon|dir ...]\n"
+        "       %s [options] --bench\n"
+        "\n"
+        "Options:\n"
+        "  --headless   Don't open the preview window. Implied by more than one input.\n"
+        "  -j <n>       Number of worker threads. Default is one per core.\n"
+        "  -o <dir>     Directory for the .cpp, .h and .dfbf outputs. Default is the\n"
+        "               current directory.\n"
+        "  --verify     Decode each .dfbf after encoding it and check it matches the\n"
+        "               .fon.\n"
+        "  --codec <classic|smallest>\n"
+        "               classic, the default, is up-prediction and nibble runs, which\n"
+        "               every decoder reads. smallest tries several predictors and run\n"
+        "               formats per font. Decoders that predate the choice ignore the\n"
+        "               flags that say which was used, and decode its output wrongly.\n"
+        "  --huffman    Also try Huffman coding each font's runs, and keep it if it is\n"
+        "               smaller. Decoding is slower. Version 0 only.\n"
+        "  --bench-decode\n"
+        "               Instead of converting, compare the size and decode speed of\n"
+        "               each input with and without --huffman.\n"
+        "  --bench      Convert a fixed suite of synthetic fonts in memory, with the\n"
+        "               other options given, and print the throughput of the whole\n"
+        "               conversion and of each stage. Needs no inputs.\n"
+        "  --bench-fons <dir>\n"
+        "               Write the --bench suite's .fon files to dir.\n"
+        "  --pack <cells|width|ink>\n"
+        "               Area of each glyph that version 1 encodes. cells, the default,\n"
+        "               is the whole cell. width skips the padding to the right of\n"
+        "               proportional glyphs. ink crops to the set pixels. Needs\n"
+        "               --dfbf-version 1.\n"
+        "  --dfbf-version <0|1>\n"
+        "               .dfbf format to write. 1 adds an index so that single glyphs\n"
+        "               can be decoded. Default is 0.\n"
+        "  --c-data <array|string>\n"
+        "               How the .cpp holds the font data. array, the default, is an\n"
+        "               array of words. string is a string literal, which compiles\n"
+        "               much faster. The .h then declares a pointer to the words.\n"
+        "  --c-decoded <all|height,height,...>\n"
+        "               Also put the sizes with these pixel heights in the .cpp already\n"
+        "               decoded, one byte array of glyph rows and one of widths each,\n"
+        "               so they can be drawn with no decoding at startup. Makes the\n"
+        "               binary bigger.\n"
+        "  --cache <dir>\n"
+        "               Keep the outputs in dir, an existing directory, keyed on a hash\n"
+        "               of the fonts and options. Inputs already converted are copied\n"
+        "               from there instead of being encoded again.\n"
+        "  --metrics <file.json>\n"
+        "               Time each stage of the conversion, count bytes and runs, and\n"
+        "               write it all, with a record per font, to file.json.\n"
+        "  --watch      Convert the inputs, then keep running and convert each .fon\n"
+        "               again whenever it is saved. Only the fonts that changed are\n"
+        "               encoded again. Directories also pick up new .fon files.\n"
+        "               Implies --headless.\n"
+        "  --watch-status <file.json>\n"
+        "               With --watch, keep file.json up to date with the state of\n"
+        "               every watched file.\n"
+        "  --stdout <dfbf|cpp|h>\n"
+        "               Write just that output to stdout, for piping into another\n"
+        "               tool. Needs a single input. Implies --headless.\n", exe_name, exe_name);
+}
 
-    MemBuf() {
-        max_len = 1000 * 1000;
-        data = new u8[max_len];
-        memset(data, 0, max_len);
-        data_num_bytes = 0;
-        hi_nibble_next = 0;
-        output_byte = 0;
-    }
 
-    void PushByte(int val) {
-        ReleaseAssert(hi_nibble_next == 0, "Attempt to write a byte when a nibble was buffered");
-        ReleaseAssert(data_num_bytes < max_len, "MemBuf full");
-        data[data_num_bytes] = val;
-        data_num_bytes++;
+// Parses "all" or a comma separated list of pixel heights into heights[],
+// which is indexed by height.
+static bool ParseDecodedHeights(const char *list, bool *heights) {
+    if (strcmp(list, "all") == 0) {
+        memset(heights, 1, 256 * sizeof(bool));
+        return true;
     }
 
-    void PushNibble(int val) {
-        if (hi_nibble_next) {
-            output_byte |= val << 4;
-            hi_nibble_next = 0;
-            PushByte(output_byte);
-            output_byte = 0;
+    const char *p = list;
+    while (1) {
+        char *end;
+        long height = strtol(p, &end, 10);
+        if (end == p || height < 1 || height > 255) {
+            return false;
         }
-        else {
-            hi_nibble_next = 1;
-            output_byte |= val;
+        heights[height] = true;
+        if (*end == '\0') {
+            return true;
         }
-    }
-
-    void WriteToBinFile(FILE *f) {
-        if (hi_nibble_next) {
-            PushNibble(0);
+        if (*end != ',') {
+            return false;
         }
-
-        ReleaseAssert(hi_nibble_next == 0, "Attempt to write a byte when a nibble was buffered 2");
-        int bytes_written = fwrite(data, 1, data_num_bytes, f);
-        ReleaseAssert(bytes_written == data_num_bytes, "Couldn't write to output file");
+        p = end + 1;
     }
+}
 
-    void WriteToCFile(FILE *f, const char *font_name, int font_width, int font_height) {
-        if (hi_nibble_next) {
-            PushNibble(0);
-        }
 
-        ReleaseAssert(hi_nibble_next == 0, "Attempt to write a byte when a nibble was buffered 2");
-        
-        int num_words = (data_num_bytes + 3) / 4;
-        fprintf(f, "unsigned const %s_%ix%i[%d] = {\n    ", font_name, font_width, font_height, num_words);
-        u32 *data32 = (u32*)data;
-        for (int i = 0; i < num_words; i++) {
-            fprintf(f, "0x%08x, ", data32[i]);
-            if (i % 8 == 7) {
-                fprintf(f, "\n    ");
+// Draws the glyph sheet in white. The region where proportional width
+// glyphs are narrower than the widest glyph is shaded in red.
+static DfBitmap *MakePreviewBitmap(FullFnt *fnt, Arena *arena) {
+    DfColour red = Colour(244, 0, 0);
+    UnpackGlyphs(fnt, arena);
+    GlyphSheet *sheet = fnt->sheet;
+    DfBitmap *bmp = BitmapCreate(sheet->width, sheet->height);
+    BitmapClear(bmp, g_colourBlack);
+    for (int y = 0; y < sheet->height; y++) {
+        for (int x = 0; x < sheet->width; x++) {
+            if (sheet->GetPix(x, y)) {
+                PutPix(bmp, x, y, g_colourWhite);
             }
         }
-        fprintf(f, "\n};\n\n");
     }
-};
-
-
-// FNT resource format explanation https://jeffpar.github.io/kbarchive/kb/065/Q65123/
-FullFnt *ReadFntResourceItem(FILE *f, int block_size) {  
-    ResourceTableItem rt_item; fread(&rt_item, 1, sizeof(ResourceTableItem), f);
-    ReleaseAssert(rt_item.resource_id & 0x8000, "Bad resource id");
-    
-    int next_item_offset = ftell(f);
-    int fnt_data_offset = block_size * rt_item.data_offset;
-    fseek(f, fnt_data_offset, SEEK_SET);
-    
-    FullFnt *full_fnt = new FullFnt;
-    FntHeader *fnt = &full_fnt->hdr;
-    fread(fnt, 1, sizeof(FntHeader), f);
-
-    ReleaseAssert(fnt->version == 0x200, "Version 0x%x found. Only version 0x200 supported.",
-        fnt->version);
-    
-    int num_glyphs = fnt->last_char - fnt->first_char + 1;
-    int bytes_per_row = ((fnt->max_width + 8) / 8) * num_glyphs;
-    int bmp_num_bytes = bytes_per_row * fnt->pix_height;
-
-    // Read the glyph table.
-    const int glyph_table_size = fnt->last_char - fnt->first_char + 2;
-    full_fnt->glyph_table = new _Glyph[fnt->last_char - fnt->first_char + 2];
-    fread(full_fnt->glyph_table, 1, glyph_table_size * sizeof(_Glyph), f);
-
-    // Read the name.
-    fseek(f, fnt_data_offset + fnt->name_offset, SEEK_SET);
-    fread(full_fnt->name, 1, sizeof(full_fnt->name), f);
-
-    // Read the bitmap.
-    fseek(f, fnt->bitmap_offset + fnt_data_offset, SEEK_SET);
-    u8 *bmp = new u8[bmp_num_bytes];
-    fread(bmp, 1, bmp_num_bytes, f);
-
-    // Create the DF bitmap.
-    full_fnt->bmp = BitmapCreate(16 * fnt->max_width, 14 * fnt->pix_height);
-    BitmapClear(full_fnt->bmp, g_colourBlack);
-    int num_chars = fnt->last_char - fnt->first_char + 1;
-    for (int i = 0; i < num_chars; i++) {
-        int num_columns = (full_fnt->glyph_table[i].pix_width + 7) / 8;
-        for (int column = 0; column < num_columns; column++) {
-            int x0 = (i % 16) * fnt->max_width + column * 8;
-            int y0 = (i / 16) * fnt->pix_height;
-            int bmp_offset = full_fnt->glyph_table[i].bitmap_offset + fnt->pix_height * column;
-            u8 *glyph = bmp + bmp_offset - 1018;
-            for (int y = 0; y < fnt->pix_height; y++) {
-                for (int x = 0; x < 8; x++) {
-                    int the_byte = glyph[y];
-                    int bit_mask = 0x80 >> (x % 8);
-                    if (the_byte & bit_mask) {
-                        PutPix(full_fnt->bmp, x0 + x, y0 + y, g_colourWhite);
-                    }
-                }
-            }
-        }
 
-        // Indicate widths of proportional width glyphs by shading in red
-        // the region where they are narrower than the widest glyph.
-        int glyph_width = full_fnt->glyph_table[i].pix_width;
-        for (int j = glyph_width; j < full_fnt->hdr.max_width; j++) {
-            int x = (i % 16) * fnt->max_width + j;
-            int y = (i / 16) * fnt->pix_height;
-            VLine(full_fnt->bmp, x, y, fnt->pix_height, g_colourRed);
+    for (int i = 0; i < 224; i++) {
+        int glyph_width = fnt->glyphs[i].pix_width;
+        for (int j = glyph_width; j < fnt->hdr->max_width; j++) {
+            int x = (i % 16) * fnt->hdr->max_width + j;
+            int y = (i / 16) * fnt->hdr->pix_height;
+            VLine(bmp, x, y, fnt->hdr->pix_height, red);
         }
     }
 
-    fseek(f, next_item_offset, SEEK_SET);
-
-    return full_fnt;
+    return bmp;
 }
 
 
-void RemoveRed(DfBitmap *bmp) {
-    for (int y = 0; y < bmp->height; y++) {
-        for (int x = 0; x < bmp->width; x++) {
-            DfColour c = GetPix(bmp, x, y);
-            if (c.c == g_colourRed.c) {
-                PutPix(bmp, x, y, g_colourBlack);
-            }
-        }
+// Draws each font's glyph sheet into bmp, side by side.
+static bool DrawPreview(const char *path, DfBitmap *bmp, ConvertError *err) {
+    MappedFile fon_file;
+    if (!fon_file.Open(path)) {
+        return err->Set("Couldn't open file '%s'", path);
     }
-}
 
-void DoUpPrediction(DfBitmap *bmp) {
-    for (int y = bmp->height - 1; y > 0; y--) {
-        for (int x = 0; x < bmp->width; x++) {
-            DfColour prevColour = GetPix(bmp, x, y - 1);
-            DfColour colour = GetPix(bmp, x, y);
-            if (prevColour.c == colour.c) {
-                PutPix(bmp, x, y, g_colourBlack);
-            }
-            else {
-                PutPix(bmp, x, y, g_colourWhite);
-            }
-
-            prevColour = colour;
-        }
-    }
-}
-
-
-void WriteDfbfToMemBuf(MemBuf *buf, FullFnt *fnt) {
-    buf->PushByte(fnt->hdr.max_width);
-    buf->PushByte(fnt->hdr.pix_height);
-
-    int flags = 0;
-    if (fnt->hdr.pix_width == 0) {
-        flags |= 1;
+    Arena arena;
+    FullFnt *fnts[MAX_FNTS_PER_FILE] = { NULL };
+    int num_fnts = 0;
+    if (!ParseFon(fon_file.view, fnts, &num_fnts, &arena, err)) {
+        return false;
     }
-    buf->PushByte(flags);
 
-    // If fnt is variable width, write the glyph widths table.
-    if (fnt->hdr.pix_width == 0) {
-        for (int c = 0; c < 224; c++) {
-            buf->PushByte(fnt->glyph_table[c].pix_width);
-        }
+    int x = 0;
+    for (int i = 0; i < num_fnts; i++) {
+        DfBitmap *fb = MakePreviewBitmap(fnts[i], &arena);
+        ScaleUpBlit(bmp, x, 0, 2, fb);
+        x += (fb->width * 2);
+        BitmapDelete(fb);
     }
 
-    RemoveRed(fnt->bmp);
-    DoUpPrediction(fnt->bmp);
-
-    // Write the RLE encoded bitmap
-    int run_len = 0;
-    DfColour prev_pix = g_colourBlack;
-    for (int y = 0; y < fnt->bmp->height; y++) {
-        for (int x = 0; x < fnt->bmp->width; x++) {
-            DfColour pix = GetPix(fnt->bmp, x, y);
-            if (pix.c != prev_pix.c) {
-                while (run_len > 0) {
-                    if (run_len >= 16 || run_len == 0) {
-                        int run_len_to_write = run_len;
-                        if (run_len_to_write > 255) {
-                            run_len_to_write = 255;
-                        }
-                        buf->PushNibble(0); // 0 is the escape char, meaning an 8-bit length follows.
-                        buf->PushNibble(run_len_to_write & 0xf);
-                        buf->PushNibble(run_len_to_write >> 4);
-                        if (run_len > 255) {
-							// If run_len is > 255, then there is no way to encode it directly.
-							// Instead we will have to output multiple runs that add up to the
-							// required total. But adjacent runs must be of opposite "values".
-							// The solution to that is to create zero length runs between them.
-							// We can only encode zero length runs using an escape too. So,
-							// output a zero lengthed run now.
-                            buf->PushNibble(0);
-                            buf->PushNibble(0);
-                            buf->PushNibble(0);
-                        }
-                        run_len -= run_len_to_write;
-                    }
-                    else if (run_len < 16) {
-                        buf->PushNibble(run_len);
-                        run_len = 0;
-                    }
-                }
-            }
-
-            run_len++;
-            prev_pix = pix;
-        }
-    }
+    return true;
 }
 
 
-char *GetNameFromPath(const char *path) {
-    const char *dot = strrchr(path, '.');
-    const char *slash = strrchr(path, '/');
-    ReleaseAssert(dot && slash && slash < dot, "Couldn't extract font name from input path of '%s'", path);
-    size_t name_len = dot - slash - 1;
-    char *rv = new char[name_len + 1];
-    memcpy(rv, slash + 1, name_len);
-    rv[name_len] = '\0';
-    return rv;
+// Failing to write the report doesn't fail the conversion.
+static void WriteMetrics(const char *metrics_path, ConvertMetrics *metrics) {
+    if (!metrics_path) {
+        return;
+    }
+    ConvertError err;
+    if (!WriteMetricsJson(metrics_path, metrics, &err)) {
+        fprintf(stderr, "%s\n", err.msg);
+    }
 }
 
 
 int main(int argc, char *argv[]) {
-    char const *path = NULL;
-    path = "c:/coding/deadfrog-lib/src/fonts/df_mono.fon";
-
-    if (!path) {
-        if (argc != 2) {
-            printf("Usage: %s <your.fon>\n", argv[0]);
-            return 0;
+    bool headless = false;
+    bool bench_decode = false;
+    bool bench = false;
+    const char *bench_fons_dir = NULL;
+    const char *metrics_path = NULL;
+    bool watch = false;
+    const char *watch_status_path = NULL;
+    int num_threads = 0;
+    ConvertOptions opts;
+    std::vector<std::string> paths;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
         }
-        else {
-            path = argv[1];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
         }
-    }
-
-    g_window = CreateWin(2300, 1000, WT_WINDOWED_FIXED, ".FON Converter");
-    BitmapClear(g_window->bmp, g_colourBlack);
-
-    FILE *f = fopen(path, "rb");
-    ReleaseAssert(f, "Couldn't open file '%s'", path);
-
-    OldExeHeader old_hdr; fread(&old_hdr, 1, sizeof(OldExeHeader), f);
-    //printf("Read old header of size %i\n", sizeof(OldExeHeader));
-    
-    int new_hdr_offset = old_hdr.num_paragraphs_in_header * 16 + sizeof(OldExeHeader);
-    //printf("New header spans 0x%x to 0x%x.\n", new_hdr_offset, new_hdr_offset + sizeof(NewExeHeader) - 1);
-
-    fseek(f, new_hdr_offset, SEEK_SET);
-    NewExeHeader new_hdr; fread(&new_hdr, 1, sizeof(NewExeHeader), f);
-    //printf("New header ID is %c%c\n", new_hdr.id[0], new_hdr.id[1]);
-    
-    int seg_table_offset = new_hdr_offset + new_hdr.seg_table_offset;
-    //printf("Seg table spans 0x%x to 0x%x\n", seg_table_offset,
-//        seg_table_offset + new_hdr.seg_table_num_items * 8 - 1);
-
-    int res_table_offset = new_hdr_offset + new_hdr.res_table_offset;
-    int res_table_num_blocks = new_hdr.num_resource_entries / sizeof(ResourceTableBlock);
-    //printf("Resource table num blocks is %i\n", res_table_num_blocks);
-    //printf("Resource table spans 0x%x to 0x%x\n", res_table_offset, new_hdr.num_resource_entries * sizeof(ResourceTableBlock));
-
-    //printf("Resident name table offset is 0x%x\n", new_hdr.resi_name_table_offset + new_hdr_offset);
-    //printf("Module ref table offset is 0x%x\n", new_hdr.module_ref_table_offset + new_hdr_offset);
-    //printf("Imported name table offset is 0x%x\n", new_hdr.imported_names_table_offset + new_hdr_offset);
-    //printf("Non resi name table offset 0x%x. Num items %i\n", new_hdr.non_resi_name_table_offset,
-//        new_hdr.non_resi_name_table_offset + new_hdr.non_resi_name_table_num_bytes);
-    
-    fseek(f, res_table_offset, SEEK_SET);
-//    char *resource_table = f.data + f.offset;
-    u16 alignment_shift_amount; fread(&alignment_shift_amount, 1, sizeof(u16), f);
-    int block_size = 1 << alignment_shift_amount;
-
-    FullFnt *all_fnts[16] = { NULL };
-    int num_fnts = 0;
-    while (1) {
-        //printf("\nResource block offset 0x%x. ", f.offset);
-        ResourceTableBlock rtblock; fread(&rtblock, 1, sizeof(ResourceTableBlock), f);
-        //printf("type id 0x%x. Num of this type %i\n", rtblock.type_id, rtblock.num_of_this_type);
-
-        if (rtblock.type_id == 0) {
-            break;
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            opts.out_dir = argv[++i];
         }
-        else if (rtblock.type_id == 0x8008) {
-            int next_block_offset = ftell(f) + sizeof(ResourceTableItem)* rtblock.num_of_this_type;
-    
-            int x = 0;
-            for (int i = 0; i < rtblock.num_of_this_type; i++) {
-                all_fnts[i] = ReadFntResourceItem(f, block_size);
-                num_fnts++;
-
-//                DoUpPrediction(all_fnts[i]->bmp);
-                DfBitmap *fb = all_fnts[i]->bmp;
-                ScaleUpBlit(g_window->bmp, x, 0, 2, fb);
-                x += (fb->width * 2);
+        else if (strcmp(argv[i], "--verify") == 0) {
+            opts.verify = true;
+        }
+        else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc) {
+            const char *codec = argv[++i];
+            if (strcmp(codec, "smallest") == 0) opts.codec = CODEC_SMALLEST;
+            else if (strcmp(codec, "classic") == 0) opts.codec = CODEC_CLASSIC;
+            else {
+                PrintUsage(argv[0]);
+                return 1;
             }
-
-            break;
         }
-        else {
-            int next_block_offset = ftell(f) + sizeof(ResourceTableItem) * rtblock.num_of_this_type;
-            
-            ResourceTableItem rt_item; fread(&rt_item, 1, sizeof(ResourceTableItem), f);
-            if (rtblock.type_id == 0x8007) {
-                ReleaseAssert(!(rt_item.resource_id & 0x8000), "Bad resource id 2");
-                //printf("Font dir name %s\n", resource_table + rt_item->resource_id);
+        else if (strcmp(argv[i], "--huffman") == 0) {
+            opts.huffman = true;
+        }
+        else if (strcmp(argv[i], "--bench-decode") == 0) {
+            bench_decode = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        }
+        else if (strcmp(argv[i], "--bench-fons") == 0 && i + 1 < argc) {
+            bench_fons_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            const char *packing = argv[++i];
+            if (strcmp(packing, "cells") == 0) opts.packing = PACK_CELLS;
+            else if (strcmp(packing, "width") == 0) opts.packing = PACK_WIDTH;
+            else if (strcmp(packing, "ink") == 0) opts.packing = PACK_INK;
+            else {
+                PrintUsage(argv[0]);
+                return 1;
             }
-    
-            fseek(f, next_block_offset, SEEK_SET);
         }
-    }
-    fclose(f);
-
-    {
-        char *fnt_name = GetNameFromPath(path);
-        char *cpp_file_name = new char[strlen(path) + 2];
-        strcpy(cpp_file_name, fnt_name);
-        strcat(cpp_file_name, ".cpp");
-        char *h_file_name = new char[strlen(path) + 2];
-        strcpy(h_file_name, fnt_name);
-        strcat(h_file_name, ".h");
-        char *bin_file_name = new char[strlen(path) + 6];
-        strcpy(bin_file_name, fnt_name);
-        strcat(bin_file_name, ".dfbf");
-
-        FILE *c_file = fopen(cpp_file_name, "w");
-        ReleaseAssert(c_file, "Couldn't create output file '%s'", cpp_file_name);
-        FILE *h_file = fopen(h_file_name, "w");
-        ReleaseAssert(c_file, "Couldn't create output file '%s'", h_file_name);
-        FILE *bin_file = fopen(bin_file_name, "wb");
-        ReleaseAssert(bin_file, "Couldn't create output file '%s'", bin_file_name);
-
-        // Write header into C file.
-        fprintf(c_file, "#include \"%s.h\"\n\n", fnt_name);
-
-        // Write header into H file.
-        fprintf(h_file,
-            "#pragma once\n"
-            "\n"
-            "#include \"../df_font.h\"\n"
-            "\n"
-            "#ifdef __cplusplus\n"
-            "extern \"C\" {\n"
-            "#endif\n"
-            "\n"
-            "extern DfFontSource %s;\n", fnt_name);
-
-        // Write header into bin file.
-        char version = 0;
-        fprintf(bin_file, "dfbf%c%c", version, num_fnts);
-        for (int i = 0; i < num_fnts; i++) {
-            u32 dummy_offset = 0;
-            fwrite(&dummy_offset, 1, 4, bin_file);
+        else if (strcmp(argv[i], "--dfbf-version") == 0 && i + 1 < argc) {
+            opts.dfbf_version = atoi(argv[++i]);
+            if (opts.dfbf_version < 0 || opts.dfbf_version > 1) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
         }
-
-        // Loop through all fonts.
-        std::vector <unsigned> font_datas_num_bytes;
-        for (int i = 0; i < num_fnts; i++) {
-            MemBuf buf;
-            FullFnt *fnt = all_fnts[i];
-                      
-            WriteDfbfToMemBuf(&buf, fnt);
-            buf.WriteToCFile(c_file, fnt_name, fnt->hdr.max_width, fnt->hdr.pix_height);
-            
-            u32 pos = ftell(bin_file);
-            fseek(bin_file, 6 + i * 4, SEEK_SET);
-            fwrite(&pos, 1, 4, bin_file);
-            fseek(bin_file, pos, SEEK_SET);
-            buf.WriteToBinFile(bin_file);
-
-            fprintf(h_file, "extern unsigned const %s_%ix%i[%d];\n", fnt_name, 
-                fnt->hdr.max_width, fnt->hdr.pix_height, (buf.data_num_bytes + 3)/4);
-
-            font_datas_num_bytes.push_back(buf.data_num_bytes);
+        else if (strcmp(argv[i], "--c-data") == 0 && i + 1 < argc) {
+            const char *c_data = argv[++i];
+            if (strcmp(c_data, "array") == 0) opts.c_data = C_DATA_ARRAY;
+            else if (strcmp(c_data, "string") == 0) opts.c_data = C_DATA_STRING;
+            else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
         }
-
-        //
-        // Write footer into H file.
-
-        fprintf(h_file,
-            "\n"
-            "#ifdef __cplusplus\n"
-            "}\n"
-            "#endif\n");
-
-
-        //
-        // Write footer into C file.
-
-        // Pixel widths
-        fprintf(c_file, "static unsigned char const %s_pixelWidths[] = { ", fnt_name);
-        for (int i = 0; i < (num_fnts - 1); i++)
-            fprintf(c_file, "%d, ", all_fnts[i]->hdr.max_width);
-        fprintf(c_file, "%d };\n", all_fnts[num_fnts - 1]->hdr.max_width);
-
-        // Pixel heights
-        fprintf(c_file, "static unsigned char const %s_pixelHeights[] = { ", fnt_name);
-        for (int i = 0; i < (num_fnts - 1); i++)
-            fprintf(c_file, "%d, ", all_fnts[i]->hdr.pix_height);
-        fprintf(c_file, "%d };\n", all_fnts[num_fnts - 1]->hdr.pix_height);
-
-        // Data blobs
-        fprintf(c_file, "static unsigned const *%s_dataBlobs[] = {\n", fnt_name);
-        for (int i = 0; i < num_fnts; i++) {
-            FullFnt *fnt = all_fnts[i];
-            fprintf(c_file, "    %s_%dx%d", fnt_name, fnt->hdr.max_width, fnt->hdr.pix_height);
-            if (i < (num_fnts - 1)) {
-                fprintf(c_file, ",\n");
+        else if (strcmp(argv[i], "--c-decoded") == 0 && i + 1 < argc) {
+            if (!ParseDecodedHeights(argv[++i], opts.c_decoded)) {
+                PrintUsage(argv[0]);
+                return 1;
             }
-        };
-        fprintf(c_file, "\n};\n");
-        
-        // Data blob sizes
-        fprintf(c_file, "static unsigned const %s_dataBlobSizes[] = {\n", fnt_name);
-        for (int i = 0; i < num_fnts; i++) {
-            fprintf(c_file, "    %d", font_datas_num_bytes[i]);
-            if (i < (num_fnts - 1)) {
-                fprintf(c_file, ",\n");
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            opts.cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        }
+        else if (strcmp(argv[i], "--watch-status") == 0 && i + 1 < argc) {
+            watch_status_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stdout") == 0 && i + 1 < argc) {
+            const char *output = argv[++i];
+            opts.to_stdout = true;
+            headless = true;
+            if (strcmp(output, "dfbf") == 0) opts.outputs = OUTPUT_DFBF;
+            else if (strcmp(output, "cpp") == 0) opts.outputs = OUTPUT_CPP;
+            else if (strcmp(output, "h") == 0) opts.outputs = OUTPUT_H;
+            else {
+                PrintUsage(argv[0]);
+                return 1;
             }
         }
-        fprintf(c_file, "\n};\n");
-
-        // DfFontSource
-        fprintf(c_file, "DfFontSource %s = {\n", fnt_name);
-        fprintf(c_file, "    %d, // numSizes\n", num_fnts);
-        fprintf(c_file, "    %s_pixelWidths,\n", fnt_name);
-        fprintf(c_file, "    %s_pixelHeights,\n", fnt_name);
-        fprintf(c_file, "    %s_dataBlobs,\n", fnt_name);
-        fprintf(c_file, "    %s_dataBlobSizes\n", fnt_name);
-        fprintf(c_file, "};\n");
+        else if (argv[i][0] == '-') {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        else {
+            ReleaseAssert(CollectInputs(argv[i], &inputs), "Couldn't open '%s'", argv[i]);
+            paths.push_back(argv[i]);
+        }
+    }
+
+    ReleaseAssert(opts.packing == PACK_CELLS || opts.dfbf_version >= 1, "--pack needs --dfbf-version 1");
+
+    if (bench || bench_fons_dir) {
+        int num_failed = 0;
+        if (bench_fons_dir) {
+            num_failed += WriteBenchFons(bench_fons_dir);
+        }
+        if (bench) {
+            num_failed += RunBenchmark(opts);
+        }
+        return num_failed ? 1 : 0;
+    }
+
+    // A watched directory can start off with no .fon files in it.
+    if (watch && !paths.empty()) {
+        ReleaseAssert(!opts.to_stdout, "--watch can't be used with --stdout");
+        return RunWatch(paths, opts, num_threads, watch_status_path);
+    }
+
+    if (inputs.empty()) {
+        PrintUsage(argv[0]);
+        return 0;
     }
 
+    if (bench_decode) {
+        return RunDecodeBenchmark(inputs, opts) ? 1 : 0;
+    }
+
+    if (opts.to_stdout) {
+        ReleaseAssert(inputs.size() == 1, "--stdout needs exactly one input");
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ConvertMetrics metrics;
+        ThreadPool pool(num_threads);
+        ConvertContext ctx;
+        ctx.metrics = metrics_path ? &metrics : NULL;
+        ctx.pool = &pool;
+        ConvertError err;
+        double start = GetRealTime();
+        bool ok = ConvertFile(inputs[0].c_str(), opts, &ctx, &err);
+        if (!ok) {
+            fprintf(stderr, "%s: %s\n", inputs[0].c_str(), err.msg);
+        }
+        PrintWarnings(inputs[0].c_str(), ctx);
+        metrics.wall_seconds = GetRealTime() - start;
+        WriteMetrics(metrics_path, &metrics);
+        return ok ? 0 : 1;
+    }
+
+    // A single input without --headless gets the preview window, as before.
+    if (inputs.size() > 1 || headless) {
+        ConvertMetrics metrics;
+        double start = GetRealTime();
+        int num_failed = RunBatch(inputs, opts, num_threads, metrics_path ? &metrics : NULL);
+        metrics.wall_seconds = GetRealTime() - start;
+        printf("Converted %d of %d files\n", (int)inputs.size() - num_failed, (int)inputs.size());
+        WriteMetrics(metrics_path, &metrics);
+        return num_failed ? 1 : 0;
+    }
+
+    g_window = CreateWin(2300, 1000, WT_WINDOWED_FIXED, ".FON Converter");
+    BitmapClear(g_window->bmp, g_colourBlack);
+
+    ConvertMetrics metrics;
+    ThreadPool pool(num_threads);
+    ConvertContext ctx;
+    ctx.metrics = metrics_path ? &metrics : NULL;
+    ctx.pool = &pool;
+    ConvertError err;
+    double start = GetRealTime();
+    ReleaseAssert(ConvertFile(inputs[0].c_str(), opts, &ctx, &err), "%s", err.msg);
+    PrintWarnings(inputs[0].c_str(), ctx);
+    metrics.wall_seconds = GetRealTime() - start;
+    WriteMetrics(metrics_path, &metrics);
+    ReleaseAssert(DrawPreview(inputs[0].c_str(), g_window->bmp, &err), "%s", err.msg);
+
     while (!g_window->windowClosed && !g_window->input.keyDowns[KEY_ESC]) {
         InputPoll(g_window);
          
@@ -481,4 +375,4 @@ int main(int argc, char *argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,162 @@
+#include "mapped_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const char *path) {
+    Close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    // CreateFileMapping refuses zero length files. Treat them as an empty view.
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return false;
+    }
+
+    const u8 *data = (const u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    map_handle = mapping;
+    view = ByteView(data, (size_t)size.QuadPart);
+    return true;
+}
+
+
+void MappedFile::Close() {
+    if (copy) {
+        free(copy);
+    }
+    else if (view.data) {
+        UnmapViewOfFile(view.data);
+    }
+    copy = NULL;
+    if (map_handle) {
+        CloseHandle((HANDLE)map_handle);
+    }
+    map_handle = NULL;
+    view = ByteView();
+}
+
+#else
+
+bool MappedFile::Open(const char *path) {
+    Close();
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        Close();
+        return false;
+    }
+
+    // mmap refuses zero length files. Treat them as an empty view.
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+
+    view = ByteView((const u8 *)data, st.st_size);
+    return true;
+}
+
+
+void MappedFile::Close() {
+    if (copy) {
+        free(copy);
+    }
+    else if (view.data) {
+        munmap((void *)view.data, view.num_bytes);
+    }
+    copy = NULL;
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = -1;
+    view = ByteView();
+}
+
+#endif
+
+
+bool MappedFile::Read(const char *path) {
+    Close();
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    // Read until a short read rather than trusting the size up front, which
+    // may change under us.
+    size_t capacity = 0;
+    size_t num_bytes = 0;
+    while (1) {
+        if (num_bytes == capacity) {
+            capacity = capacity ? capacity * 2 : 64 * 1024;
+            u8 *grown = (u8 *)realloc(copy, capacity);
+            if (!grown) {
+                fclose(file);
+                Close();
+                return false;
+            }
+            copy = grown;
+        }
+        size_t num_read = fread(copy + num_bytes, 1, capacity - num_bytes, file);
+        num_bytes += num_read;
+        if (num_bytes < capacity) {
+            break;
+        }
+    }
+
+    bool ok = !ferror(file);
+    fclose(file);
+    if (!ok) {
+        Close();
+        return false;
+    }
+
+    view = ByteView(copy, num_bytes);
+    return true;
+}
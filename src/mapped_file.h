@@ -0,0 +1,70 @@
+#pragma once
+
+#include "windows_fnt.h"
+
+#include <stddef.h>
+
+
+// A bounds-checked window onto a range of bytes. Used to read the structs in
+// windows_fnt.h in place, rather than copying them out with fread.
+struct ByteView {
+    const u8 *data;
+    size_t num_bytes;
+
+    ByteView() {
+        data = NULL;
+        num_bytes = 0;
+    }
+
+    ByteView(const u8 *_data, size_t _num_bytes) {
+        data = _data;
+        num_bytes = _num_bytes;
+    }
+
+    // Returns NULL if count items of type T starting at offset don't fit in
+    // the view.
+    template <typename T>
+    const T *Get(size_t offset, size_t count = 1) const {
+        if (offset > num_bytes || count > (num_bytes - offset) / sizeof(T)) {
+            return NULL;
+        }
+        return (const T *)(data + offset);
+    }
+
+    // Returns an empty view if the range doesn't fit.
+    ByteView Sub(size_t offset, size_t len) const {
+        if (offset > num_bytes || len > num_bytes - offset) {
+            return ByteView();
+        }
+        return ByteView(data + offset, len);
+    }
+};
+
+
+// Maps a whole file read-only. The view stays valid until Close().
+struct MappedFile {
+    ByteView view;
+    void *map_handle;
+    int fd;
+    u8 *copy;                       // The file's bytes, if Read() rather than mapped.
+
+    MappedFile() {
+        map_handle = NULL;
+        fd = -1;
+        copy = NULL;
+    }
+
+    ~MappedFile() {
+        Close();
+    }
+
+    bool Open(const char *path);
+
+    // Like Open(), but copies the file into memory. A mapping of a file that
+    // is truncated while it is being read faults, which a copy can't. Reads
+    // up to the end of the file as it is then, whatever size it was opened
+    // at.
+    bool Read(const char *path);
+
+    void Close();
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "windows_fnt.h"
+
+#include "df_common.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// A byte buffer that data can also be appended to a nibble at a time. It
+// grows geometrically and Reset() keeps the allocation, so one MemBuf can be
+// reused for every font of every file a thread converts. The output stage
+// also builds the text of the .cpp and .h files in MemBufs, so each file can
+// be written with a single fwrite.
+struct MemBuf {
+    u8 *data;
+    int capacity;
+    int data_num_bytes;
+    int hi_nibble_next;
+    int output_byte;
+
+    MemBuf() {
+        capacity = 4096;
+        data = (u8 *)malloc(capacity);
+        data_num_bytes = 0;
+        hi_nibble_next = 0;
+        output_byte = 0;
+    }
+
+    ~MemBuf() {
+        free(data);
+    }
+
+    void Reset() {
+        data_num_bytes = 0;
+        hi_nibble_next = 0;
+        output_byte = 0;
+    }
+
+    void Reserve(int num_bytes) {
+        if (num_bytes <= capacity) {
+            return;
+        }
+        while (capacity < num_bytes) {
+            capacity *= 2;
+        }
+        data = (u8 *)realloc(data, capacity);
+        ReleaseAssert(data, "Out of memory growing MemBuf to %d bytes", capacity);
+    }
+
+    void PushByte(int val) {
+        ReleaseAssert(hi_nibble_next == 0, "Attempt to write a byte when a nibble was buffered");
+        if (data_num_bytes == capacity) {
+            Reserve(capacity + 1);
+        }
+        data[data_num_bytes] = val;
+        data_num_bytes++;
+    }
+
+    void PushNibble(int val) {
+        if (hi_nibble_next) {
+            output_byte |= val << 4;
+            hi_nibble_next = 0;
+            PushByte(output_byte);
+            output_byte = 0;
+        }
+        else {
+            hi_nibble_next = 1;
+            output_byte |= val;
+        }
+    }
+
+    // Appends count nibbles, up to 16. The first is in the low 4 bits of
+    // vals. Whole bytes are stored as one little endian u64 write.
+    void PushNibbles(u64 vals, int count) {
+        if (count == 0) {
+            return;
+        }
+
+        if (hi_nibble_next) {
+            PushNibble(vals & 0xf);
+            vals >>= 4;
+            count--;
+        }
+
+        // Store all 8 bytes. Only the complete ones are kept; anything past
+        // them gets overwritten by later pushes.
+        int num_bytes = count / 2;
+        Reserve(data_num_bytes + 8);
+        memcpy(data + data_num_bytes, &vals, 8);
+        data_num_bytes += num_bytes;
+
+        if (count & 1) {
+            hi_nibble_next = 1;
+            output_byte = (vals >> (num_bytes * 8)) & 0xf;
+        }
+    }
+
+    // Writes out a half-filled byte, padding with a zero nibble.
+    void FlushNibble() {
+        if (hi_nibble_next) {
+            PushNibble(0);
+        }
+    }
+
+    void PushBytes(const void *src, int num_bytes) {
+        ReleaseAssert(hi_nibble_next == 0, "Attempt to write bytes when a nibble was buffered");
+        Reserve(data_num_bytes + num_bytes);
+        memcpy(data + data_num_bytes, src, num_bytes);
+        data_num_bytes += num_bytes;
+    }
+
+    // Appends formatted text, without a terminating '\0'.
+    void Printf(const char *fmt, ...) {
+        ReleaseAssert(hi_nibble_next == 0, "Attempt to write text when a nibble was buffered");
+        while (1) {
+            int space = capacity - data_num_bytes;
+            va_list args;
+            va_start(args, fmt);
+            int len = vsnprintf((char *)data + data_num_bytes, space, fmt, args);
+            va_end(args);
+
+            // Older MSVC runtimes return -1 rather than the needed length
+            // when the output doesn't fit.
+            if (len >= 0 && len < space) {
+                data_num_bytes += len;
+                return;
+            }
+            Reserve(len >= 0 ? data_num_bytes + len + 1 : capacity * 2);
+        }
+    }
+};
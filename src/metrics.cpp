@@ -0,0 +1,134 @@
+#include "metrics.h"
+
+#include "converter.h"
+#include "output_writer.h"
+
+#include "df_time.h"
+
+#include <algorithm>
+#include <string.h>
+
+
+static const char *g_stageNames[NUM_STAGES] = {
+    "parse", "cache", "unpack", "mask", "cells", "predict", "runs", "huffman", "verify",
+    "emit_c", "emit_dfbf", "write"
+};
+
+
+const char *GetStageName(int stage) {
+    return g_stageNames[stage];
+}
+
+
+void ConvertMetrics::Reset() {
+    for (int i = 0; i < NUM_STAGES; i++) {
+        stage_seconds[i] = 0.0;
+    }
+    wall_seconds = 0.0;
+    num_files = 0;
+    num_failed = 0;
+    num_cache_hits = 0;
+    num_bytes_read = 0;
+    num_column_reads = 0;
+    num_bytes_written = 0;
+    fonts.clear();
+}
+
+
+void ConvertMetrics::Merge(ConvertMetrics const &other) {
+    for (int i = 0; i < NUM_STAGES; i++) {
+        stage_seconds[i] += other.stage_seconds[i];
+    }
+    num_files += other.num_files;
+    num_failed += other.num_failed;
+    num_cache_hits += other.num_cache_hits;
+    num_bytes_read += other.num_bytes_read;
+    num_column_reads += other.num_column_reads;
+    num_bytes_written += other.num_bytes_written;
+    fonts.insert(fonts.end(), other.fonts.begin(), other.fonts.end());
+}
+
+
+StageTimer::StageTimer(ConvertMetrics *_metrics, int _stage) {
+    metrics = _metrics;
+    stage = _stage;
+    start = metrics ? GetRealTime() : 0.0;
+}
+
+
+StageTimer::~StageTimer() {
+    if (metrics) {
+        metrics->stage_seconds[stage] += GetRealTime() - start;
+    }
+}
+
+
+static bool FontLessThan(FontMetrics const &a, FontMetrics const &b) {
+    int cmp = strcmp(a.path.c_str(), b.path.c_str());
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    return a.font_index < b.font_index;
+}
+
+
+void PushJsonString(MemBuf *buf, const char *str) {
+    buf->PushByte('"');
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            buf->PushByte('\\');
+            buf->PushByte(c);
+        }
+        else if (c < 0x20) {
+            buf->Printf("\\u%04x", c);
+        }
+        else {
+            buf->PushByte(c);
+        }
+    }
+    buf->PushByte('"');
+}
+
+
+bool WriteMetricsJson(const char *path, ConvertMetrics *metrics, ConvertError *err) {
+    std::sort(metrics->fonts.begin(), metrics->fonts.end(), FontLessThan);
+
+    MemBuf buf;
+    buf.Printf("{\n");
+    buf.Printf("  \"wall_seconds\": %.6f,\n", metrics->wall_seconds);
+    buf.Printf("  \"files\": %d,\n", metrics->num_files);
+    buf.Printf("  \"failed\": %d,\n", metrics->num_failed);
+    buf.Printf("  \"cache_hits\": %d,\n", metrics->num_cache_hits);
+    buf.Printf("  \"bytes_read\": %llu,\n", (unsigned long long)metrics->num_bytes_read);
+    buf.Printf("  \"column_reads\": %llu,\n", (unsigned long long)metrics->num_column_reads);
+    buf.Printf("  \"bytes_written\": %llu,\n", (unsigned long long)metrics->num_bytes_written);
+
+    buf.Printf("  \"stage_seconds\": {");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        buf.Printf("%s\n    \"%s\": %.6f", i ? "," : "", GetStageName(i), metrics->stage_seconds[i]);
+    }
+    buf.Printf("\n  },\n");
+
+    buf.Printf("  \"fonts\": [");
+    for (unsigned i = 0; i < metrics->fonts.size(); i++) {
+        FontMetrics const &font = metrics->fonts[i];
+        int num_nibbles = 0;
+        if (!(font.flags & DFBF_FLAG_BYTE_RUNS)) {
+            num_nibbles = font.runs.num_runs + 2 * font.runs.num_escapes;
+        }
+        double ratio = font.blob_num_bytes ? font.sheet_num_bytes / (double)font.blob_num_bytes : 0.0;
+
+        buf.Printf("%s\n    { \"file\": ", i ? "," : "");
+        PushJsonString(&buf, font.path.c_str());
+        buf.Printf(", \"font\": %d, \"max_width\": %d, \"pix_height\": %d, \"flags\": %d,"
+            " \"sheet_bytes\": %d, \"blob_bytes\": %d, \"ratio\": %.3f,"
+            " \"runs\": %d, \"escapes\": %d, \"nibbles\": %d }",
+            font.font_index, font.max_width, font.pix_height, font.flags,
+            font.sheet_num_bytes, font.blob_num_bytes, ratio,
+            font.runs.num_runs, font.runs.num_escapes, num_nibbles);
+    }
+    buf.Printf("\n  ]\n}\n");
+
+    return WriteArtifact(path, &buf, true, err);
+}
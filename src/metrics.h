@@ -0,0 +1,102 @@
+#pragma once
+
+#include "windows_fnt.h"
+
+#include <string>
+#include <vector>
+
+
+struct ConvertError;
+struct MemBuf;
+
+
+// Optional instrumentation of the conversion pipeline, enabled with
+// --metrics. Each worker thread accumulates into its own ConvertMetrics,
+// pointed to by its ConvertContext, and RunBatch merges them at the end, so
+// there is no locking. When disabled, the pipeline is passed NULL and the timers don't
+// even read the clock.
+
+enum {
+    STAGE_PARSE,                    // Reading the exe headers, resource table and FNT headers.
+    STAGE_CACHE,                    // Hashing the inputs, and cache lookups and stores.
+    STAGE_UNPACK,                   // Unpacking the glyphs into the sheet. Classic has no sheet.
+    STAGE_MASK,                     // The width masks, that clear the padding of proportional glyphs.
+    STAGE_CELLS,                    // Version 1 splitting into cells, deduplicating and packing.
+    STAGE_PREDICT,                  // Every predictor tried.
+    STAGE_RUNS,                     // Run length coding every candidate. All of classic's streamed pass.
+    STAGE_HUFFMAN,                  // Huffman coding the nibble runs.
+    STAGE_VERIFY,
+    STAGE_EMIT_C,                   // Building the .cpp and .h text.
+    STAGE_EMIT_DFBF,
+    STAGE_WRITE,                    // Writing the outputs to disk or stdout.
+    NUM_STAGES
+};
+
+const char *GetStageName(int stage);
+
+
+// Counts for one run length coded stream. num_runs includes the zero
+// length runs that split long runs and lead a stream that starts with a 1.
+// num_escapes is how many of those need the nibble format's escape, so is 0
+// for byte runs.
+struct RunStats {
+    int num_runs;
+    int num_escapes;
+
+    RunStats() {
+        num_runs = 0;
+        num_escapes = 0;
+    }
+};
+
+
+struct FontMetrics {
+    std::string path;               // Or the name passed to ConvertFonBuffer().
+    int font_index;
+    int max_width;
+    int pix_height;
+    int flags;                      // The blob's DFBF_FLAG_* bits.
+    int sheet_num_bytes;            // The 224 glyph cells at 1 bit per pixel.
+    int blob_num_bytes;
+    RunStats runs;                  // Of the encoding that was kept.
+};
+
+
+struct ConvertMetrics {
+    double stage_seconds[NUM_STAGES];   // Summed over all threads.
+    double wall_seconds;            // Set by whoever runs the conversions.
+    int num_files;
+    int num_failed;
+    int num_cache_hits;
+    u64 num_bytes_read;             // Size of the .fon files.
+    u64 num_column_reads;           // Byte columns gathered from the FNT bitmaps.
+    u64 num_bytes_written;
+    std::vector<FontMetrics> fonts;
+
+    ConvertMetrics() {
+        Reset();
+    }
+
+    void Reset();
+    void Merge(ConvertMetrics const &other);
+};
+
+
+// Adds the time from construction to destruction to one stage, if metrics
+// isn't NULL.
+struct StageTimer {
+    ConvertMetrics *metrics;
+    int stage;
+    double start;
+
+    StageTimer(ConvertMetrics *_metrics, int _stage);
+    ~StageTimer();
+};
+
+
+// Writes metrics as JSON, with the fonts sorted by path so that the report
+// doesn't depend on which thread did what.
+bool WriteMetricsJson(const char *path, ConvertMetrics *metrics, ConvertError *err);
+
+// Appends str to buf as a quoted JSON string.
+void PushJsonString(MemBuf *buf, const char *str);
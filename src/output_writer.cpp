@@ -0,0 +1,464 @@
+#include "output_writer.h"
+
+#include "dfbf_decoder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+// Returns the first font whose blob is identical to font i's, which is i
+// itself if there isn't an earlier one. A .fon can hold the same font more
+// than once, eg for different character sets that only differ outside the
+// range we convert. The copies share one blob in the outputs.
+static int FindSharedBlob(MemBuf *const *font_blobs, int i) {
+    for (int j = 0; j < i; j++) {
+        if (font_blobs[j]->data_num_bytes == font_blobs[i]->data_num_bytes &&
+            memcmp(font_blobs[j]->data, font_blobs[i]->data, font_blobs[i]->data_num_bytes) == 0) {
+            return j;
+        }
+    }
+    return i;
+}
+
+
+void BuildDfbf(MemBuf *out, int version, MemBuf *const *font_blobs, int num_fnts) {
+    out->PushBytes("dfbf", 4);
+    out->PushByte(version);
+    out->PushByte(num_fnts);
+
+    // The offset of each font's data from the start of the file.
+    u32 offsets[MAX_FNTS_PER_FILE];
+    u32 offset = 6 + num_fnts * 4;
+    for (int i = 0; i < num_fnts; i++) {
+        int shared = FindSharedBlob(font_blobs, i);
+        if (shared != i) {
+            offsets[i] = offsets[shared];
+        }
+        else {
+            offsets[i] = offset;
+            offset += font_blobs[i]->data_num_bytes;
+        }
+        out->PushBytes(&offsets[i], 4);
+    }
+
+    for (int i = 0; i < num_fnts; i++) {
+        if (FindSharedBlob(font_blobs, i) == i) {
+            out->PushBytes(font_blobs[i]->data, font_blobs[i]->data_num_bytes);
+        }
+    }
+}
+
+
+// Two lowercase hex digits for each byte value.
+struct HexTable {
+    char digits[256][2];
+
+    HexTable() {
+        const char *hex = "0123456789abcdef";
+        for (int i = 0; i < 256; i++) {
+            digits[i][0] = hex[i >> 4];
+            digits[i][1] = hex[i & 0xf];
+        }
+    }
+};
+
+static const HexTable s_hex;
+
+
+// MSVC won't compile a string literal longer than this. Bigger blobs are
+// written as arrays in C_DATA_STRING mode too.
+enum { MAX_C_STRING_BYTES = 65535 };
+
+
+// Returns where the next num_bytes of text go. The caller must then advance
+// out->data_num_bytes by however many it used.
+static char *ReserveText(MemBuf *out, int num_bytes) {
+    out->Reserve(out->data_num_bytes + num_bytes);
+    return (char *)out->data + out->data_num_bytes;
+}
+
+
+// The blob as little endian words, eight to a line, "0x%08x, " each. The
+// last word is zero padded. Formatting goes through a lookup table straight
+// into out, as one Printf per word was most of the time taken to write the
+// .cpp of a big font.
+static void AppendHexWords(MemBuf *out, const MemBuf *blob) {
+    int num_words = (blob->data_num_bytes + 3) / 4;
+    char *start = ReserveText(out, num_words * 12 + (num_words / 8) * 5);
+    char *text = start;
+    for (int i = 0; i < num_words; i++) {
+        u32 word = 0;
+        int num_bytes = blob->data_num_bytes - i * 4;
+        memcpy(&word, blob->data + i * 4, num_bytes < 4 ? num_bytes : 4);
+
+        text[0] = '0';
+        text[1] = 'x';
+        memcpy(text + 2, s_hex.digits[word >> 24], 2);
+        memcpy(text + 4, s_hex.digits[(word >> 16) & 0xff], 2);
+        memcpy(text + 6, s_hex.digits[(word >> 8) & 0xff], 2);
+        memcpy(text + 8, s_hex.digits[word & 0xff], 2);
+        text[10] = ',';
+        text[11] = ' ';
+        text += 12;
+        if (i % 8 == 7) {
+            memcpy(text, "\n    ", 5);
+            text += 5;
+        }
+    }
+    out->data_num_bytes += (int)(text - start);
+}
+
+
+// The blob as a string literal, split over lines of about 80 characters.
+// Printable characters are written as is and the rest as the shortest octal
+// escape, padded to three digits where a digit follows. Compilers parse
+// this several times faster than the equivalent array of words.
+static void AppendStringLiteral(MemBuf *out, const MemBuf *blob) {
+    int num_bytes = blob->data_num_bytes;
+    char *start = ReserveText(out, num_bytes * 4 + (num_bytes / 16 + 1) * 8);
+    char *text = start;
+    char *line_start = text;
+    memcpy(text, "    \"", 5);
+    text += 5;
+    for (int i = 0; i < num_bytes; i++) {
+        u8 c = blob->data[i];
+        bool next_is_digit = i + 1 < num_bytes && blob->data[i + 1] >= '0' && blob->data[i + 1] <= '9';
+        if (c == '"' || c == '\\' || c == '?') {
+            // Escaping ? avoids trigraphs.
+            text[0] = '\\';
+            text[1] = c;
+            text += 2;
+        }
+        else if (c >= 0x20 && c < 0x7f) {
+            *text++ = c;
+        }
+        else {
+            *text++ = '\\';
+            if (c >= 64 || next_is_digit) {
+                *text++ = '0' + (c >> 6);
+            }
+            if (c >= 8 || next_is_digit) {
+                *text++ = '0' + ((c >> 3) & 7);
+            }
+            *text++ = '0' + (c & 7);
+        }
+
+        if (text - line_start >= 80 && i + 1 < num_bytes) {
+            memcpy(text, "\"\n    \"", 7);
+            text += 7;
+            line_start = text - 5;
+        }
+    }
+    memcpy(text, "\"\n", 2);
+    text += 2;
+    out->data_num_bytes += (int)(text - start);
+}
+
+
+static void AppendCArray(MemBuf *out, const MemBuf *blob, const char *font_name,
+                         int font_width, int font_height, int c_data) {
+    int num_words = (blob->data_num_bytes + 3) / 4;
+    if (c_data == C_DATA_ARRAY) {
+        out->Printf("unsigned const %s_%ix%i[%d] = {\n    ", font_name, font_width, font_height, num_words);
+        AppendHexWords(out, blob);
+        out->Printf("\n};\n\n");
+        return;
+    }
+
+    // The string is in a char array that is aligned, and long enough, for
+    // the decoder to read it as words. The header declares a pointer to the
+    // words. BuildCSource() points dataBlobs straight at the array, so that
+    // it is initialised statically.
+    const char *cast = "";
+    if (blob->data_num_bytes <= MAX_C_STRING_BYTES) {
+        out->Printf("static DFBF_ALIGN4 char const %s_%ix%i_data[%d] = {\n", font_name, font_width,
+            font_height, (blob->data_num_bytes + 4) & ~3);
+        AppendStringLiteral(out, blob);
+        out->Printf("};\n");
+        cast = "(unsigned const *)";
+    }
+    else {
+        out->Printf("static unsigned const %s_%ix%i_data[%d] = {\n    ", font_name, font_width,
+            font_height, num_words);
+        AppendHexWords(out, blob);
+        out->Printf("\n};\n");
+    }
+    out->Printf("unsigned const *const %s_%ix%i = %s%s_%ix%i_data;\n\n", font_name, font_width,
+        font_height, cast, font_name, font_width, font_height);
+}
+
+
+// The bytes, sixteen to a line, "0x%02x, " each.
+static void AppendHexBytes(MemBuf *out, const u8 *bytes, int num_bytes) {
+    char *start = ReserveText(out, num_bytes * 6 + (num_bytes / 16) * 5);
+    char *text = start;
+    for (int i = 0; i < num_bytes; i++) {
+        text[0] = '0';
+        text[1] = 'x';
+        memcpy(text + 2, s_hex.digits[bytes[i]], 2);
+        text[4] = ',';
+        text[5] = ' ';
+        text += 6;
+        if (i % 16 == 15 && i + 1 < num_bytes) {
+            memcpy(text, "\n    ", 5);
+            text += 5;
+        }
+    }
+    out->data_num_bytes += (int)(text - start);
+}
+
+
+static int GetDecodedRowBytes(FullFnt *fnt) {
+    return (fnt->hdr->max_width + 7) / 8;
+}
+
+
+// Sizes with no pixels have nothing to decode, so get no arrays.
+static bool IsDecodedSize(FullFnt *fnt, ConvertOptions const &opts) {
+    const FntHeader *hdr = fnt->hdr;
+    return opts.c_decoded[hdr->pix_height] && hdr->pix_height > 0 && hdr->max_width > 0;
+}
+
+
+// The font decoded from its blob, so that it is exactly what the decoder
+// would give at runtime. The glyphs array holds the 224 glyphs in order,
+// each pix_height rows of GetDecodedRowBytes() bytes, with the leftmost
+// pixel in the top bit. The widths array has every glyph's width, even for
+// fixed width fonts.
+static bool AppendDecodedArrays(MemBuf *out, const MemBuf *blob, FullFnt *fnt, const char *font_name,
+                                int dfbf_version, ConvertError *err) {
+    DecodedFont decoded;
+    if (!DecodeDfbfBlob(ByteView(blob->data, blob->data_num_bytes), dfbf_version, &decoded, err)) {
+        return false;
+    }
+
+    int max_width = decoded.max_width;
+    int pix_height = decoded.pix_height;
+    int row_bytes = GetDecodedRowBytes(fnt);
+    std::vector<u8> glyphs(224 * pix_height * row_bytes, 0);
+    for (int c = 0; c < 224; c++) {
+        int x0 = (c % 16) * max_width;
+        int y0 = (c / 16) * pix_height;
+        u8 *glyph = &glyphs[c * pix_height * row_bytes];
+        for (int y = 0; y < pix_height; y++) {
+            for (int x = 0; x < max_width; x++) {
+                if (decoded.sheet->GetPix(x0 + x, y0 + y)) {
+                    glyph[y * row_bytes + x / 8] |= 0x80 >> (x % 8);
+                }
+            }
+        }
+    }
+
+    u8 widths[224];
+    for (int c = 0; c < 224; c++) {
+        widths[c] = (decoded.flags & DFBF_FLAG_PROPORTIONAL) ? decoded.widths[c] : max_width;
+    }
+
+    out->Printf("unsigned char const %s_%ix%i_glyphs[%d] = {\n    ", font_name, max_width, pix_height,
+        (int)glyphs.size());
+    AppendHexBytes(out, &glyphs[0], (int)glyphs.size());
+    out->Printf("\n};\n");
+    out->Printf("unsigned char const %s_%ix%i_widths[224] = {\n    ", font_name, max_width, pix_height);
+    AppendHexBytes(out, widths, 224);
+    out->Printf("\n};\n\n");
+    return true;
+}
+
+
+bool BuildCSource(MemBuf *out, const char *fnt_name, FullFnt *const *all_fnts,
+                  MemBuf *const *font_blobs, int num_fnts, ConvertOptions const &opts,
+                  ConvertError *err) {
+    out->Printf("#include \"%s.h\"\n\n", fnt_name);
+    if (opts.c_data == C_DATA_STRING) {
+        out->Printf(
+            "#if defined(_MSC_VER)\n"
+            "#define DFBF_ALIGN4 __declspec(align(4))\n"
+            "#else\n"
+            "#define DFBF_ALIGN4 __attribute__((aligned(4)))\n"
+            "#endif\n"
+            "\n");
+    }
+
+    // A shared blob has the same dimensions, so the same array name.
+    for (int i = 0; i < num_fnts; i++) {
+        FullFnt *fnt = all_fnts[i];
+        if (FindSharedBlob(font_blobs, i) == i) {
+            AppendCArray(out, font_blobs[i], fnt_name, fnt->hdr->max_width, fnt->hdr->pix_height, opts.c_data);
+            if (IsDecodedSize(fnt, opts) &&
+                !AppendDecodedArrays(out, font_blobs[i], fnt, fnt_name, opts.dfbf_version, err)) {
+                return false;
+            }
+        }
+    }
+
+    // Pixel widths
+    out->Printf("static unsigned char const %s_pixelWidths[] = { ", fnt_name);
+    for (int i = 0; i < (num_fnts - 1); i++)
+        out->Printf("%d, ", all_fnts[i]->hdr->max_width);
+    out->Printf("%d };\n", all_fnts[num_fnts - 1]->hdr->max_width);
+
+    // Pixel heights
+    out->Printf("static unsigned char const %s_pixelHeights[] = { ", fnt_name);
+    for (int i = 0; i < (num_fnts - 1); i++)
+        out->Printf("%d, ", all_fnts[i]->hdr->pix_height);
+    out->Printf("%d };\n", all_fnts[num_fnts - 1]->hdr->pix_height);
+
+    // Data blobs. In string mode the pointers declared in the header aren't
+    // constant expressions, so the arrays they point to are used instead.
+    out->Printf("static unsigned const *%s_dataBlobs[] = {\n", fnt_name);
+    for (int i = 0; i < num_fnts; i++) {
+        FullFnt *fnt = all_fnts[i];
+        if (opts.c_data == C_DATA_STRING) {
+            out->Printf("    (unsigned const *)%s_%dx%d_data", fnt_name, fnt->hdr->max_width,
+                fnt->hdr->pix_height);
+        }
+        else {
+            out->Printf("    %s_%dx%d", fnt_name, fnt->hdr->max_width, fnt->hdr->pix_height);
+        }
+        if (i < (num_fnts - 1)) {
+            out->Printf(",\n");
+        }
+    };
+    out->Printf("\n};\n");
+
+    // Data blob sizes
+    out->Printf("static unsigned const %s_dataBlobSizes[] = {\n", fnt_name);
+    for (int i = 0; i < num_fnts; i++) {
+        out->Printf("    %d", font_blobs[i]->data_num_bytes);
+        if (i < (num_fnts - 1)) {
+            out->Printf(",\n");
+        }
+    }
+    out->Printf("\n};\n");
+
+    // DfFontSource
+    out->Printf("DfFontSource %s = {\n", fnt_name);
+    out->Printf("    %d, // numSizes\n", num_fnts);
+    out->Printf("    %s_pixelWidths,\n", fnt_name);
+    out->Printf("    %s_pixelHeights,\n", fnt_name);
+    out->Printf("    %s_dataBlobs,\n", fnt_name);
+    out->Printf("    %s_dataBlobSizes\n", fnt_name);
+    out->Printf("};\n");
+    return true;
+}
+
+
+void BuildCHeader(MemBuf *out, const char *fnt_name, FullFnt *const *all_fnts,
+                  MemBuf *const *font_blobs, int num_fnts, ConvertOptions const &opts) {
+    out->Printf(
+        "#pragma once\n"
+        "\n"
+        "#include \"../df_font.h\"\n"
+        "\n"
+        "#ifdef __cplusplus\n"
+        "extern \"C\" {\n"
+        "#endif\n"
+        "\n"
+        "extern DfFontSource %s;\n", fnt_name);
+
+    for (int i = 0; i < num_fnts; i++) {
+        FullFnt *fnt = all_fnts[i];
+        if (FindSharedBlob(font_blobs, i) != i) {
+            continue;
+        }
+        if (opts.c_data == C_DATA_ARRAY) {
+            out->Printf("extern unsigned const %s_%ix%i[%d];\n", fnt_name,
+                fnt->hdr->max_width, fnt->hdr->pix_height, (font_blobs[i]->data_num_bytes + 3)/4);
+        }
+        else {
+            out->Printf("extern unsigned const *const %s_%ix%i;\n", fnt_name,
+                fnt->hdr->max_width, fnt->hdr->pix_height);
+        }
+    }
+
+    // The pre-decoded sizes, if any.
+    bool any_decoded = false;
+    for (int i = 0; i < num_fnts; i++) {
+        FullFnt *fnt = all_fnts[i];
+        if (FindSharedBlob(font_blobs, i) != i || !IsDecodedSize(fnt, opts)) {
+            continue;
+        }
+        if (!any_decoded) {
+            out->Printf(
+                "\n"
+                "// Already decoded glyphs. Glyph c, for char 32 + c, is the pix_height rows\n"
+                "// of (max_width + 7) / 8 bytes at _glyphs[c * pix_height * ((max_width + 7) / 8)],\n"
+                "// with the leftmost pixel in the top bit. _widths[c] is its width.\n");
+            any_decoded = true;
+        }
+        int max_width = fnt->hdr->max_width;
+        int pix_height = fnt->hdr->pix_height;
+        out->Printf("extern unsigned char const %s_%ix%i_glyphs[%d];\n", fnt_name, max_width, pix_height,
+            224 * pix_height * GetDecodedRowBytes(fnt));
+        out->Printf("extern unsigned char const %s_%ix%i_widths[224];\n", fnt_name, max_width, pix_height);
+    }
+
+    out->Printf(
+        "\n"
+        "#ifdef __cplusplus\n"
+        "}\n"
+        "#endif\n");
+}
+
+
+bool WriteArtifact(const char *path, const MemBuf *buf, bool text, ConvertError *err) {
+    FILE *f = stdout;
+    if (path) {
+        f = fopen(path, text ? "w" : "wb");
+        if (!f) {
+            return err->Set("Couldn't create output file '%s'", path);
+        }
+    }
+
+    size_t bytes_written = fwrite(buf->data, 1, buf->data_num_bytes, f);
+    bool ok = bytes_written == (size_t)buf->data_num_bytes;
+    if (path) {
+        ok = (fclose(f) == 0) && ok;
+    }
+    else {
+        ok = (fflush(f) == 0) && ok;
+    }
+
+    if (!ok) {
+        return err->Set("Couldn't write to '%s'", path ? path : "stdout");
+    }
+    return true;
+}
+
+
+bool ReplaceArtifact(const char *path, const MemBuf *buf, bool text, ConvertError *err) {
+    // The buffer's address tells apart threads of this process that happen to
+    // be writing the same file, and the process id tells apart other runs.
+#ifdef _WIN32
+    unsigned pid = GetCurrentProcessId();
+#else
+    unsigned pid = getpid();
+#endif
+    char suffix[64];
+    sprintf(suffix, ".%u_%p.tmp", pid, (const void *)buf);
+    std::string tmp_path = std::string(path) + suffix;
+
+    if (!WriteArtifact(tmp_path.c_str(), buf, text, err)) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    bool ok = MoveFileExA(tmp_path.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool ok = rename(tmp_path.c_str(), path) == 0;
+#endif
+    if (!ok) {
+        remove(tmp_path.c_str());
+        return err->Set("Couldn't replace output file '%s'", path);
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "converter.h"
+
+
+// The output stage. Each artifact is built completely in memory from the
+// already encoded fonts, so the .dfbf header can be worked out up front from
+// the blob sizes, and then written sequentially with one fwrite.
+
+void BuildDfbf(MemBuf *out, int version, MemBuf *const *font_blobs, int num_fnts);
+// opts.c_data is how the .cpp holds each font blob. The sizes in
+// opts.c_decoded are also written out already decoded, so that programs can
+// draw them without decoding anything at startup. BuildCSource() fails if
+// one of those blobs doesn't decode.
+bool BuildCSource(MemBuf *out, const char *fnt_name, FullFnt *const *fnts,
+                  MemBuf *const *font_blobs, int num_fnts, ConvertOptions const &opts,
+                  ConvertError *err);
+void BuildCHeader(MemBuf *out, const char *fnt_name, FullFnt *const *fnts,
+                  MemBuf *const *font_blobs, int num_fnts, ConvertOptions const &opts);
+
+// Writes buf to path, or to stdout if path is NULL. Text files are opened in
+// text mode so that Windows builds get CRLF line endings, as before.
+bool WriteArtifact(const char *path, const MemBuf *buf, bool text, ConvertError *err);
+
+// Writes buf to a temporary file next to path, then renames it over path, so
+// that anything reading path sees either the old file or the new one, never
+// half of one.
+bool ReplaceArtifact(const char *path, const MemBuf *buf, bool text, ConvertError *err);
@@ -0,0 +1,141 @@
+#include "predictor.h"
+#include "arena.h"
+
+#include <string.h>
+
+
+// Clears the bits past the right edge, which a left shift can move a pixel into.
+static void ClearPastWidth(GlyphSheet *sheet, u64 *row) {
+    int num_bits = sheet->width & 63;
+    if (num_bits) {
+        row[sheet->stride - 1] &= (1ULL << num_bits) - 1;
+    }
+}
+
+
+static void PredictUp(GlyphSheet *sheet) {
+    for (int y = sheet->height - 1; y > 0; y--) {
+        u64 *row = sheet->Row(y);
+        const u64 *above = sheet->Row(y - 1);
+        for (int j = 0; j < sheet->stride; j++) {
+            row[j] ^= above[j];
+        }
+    }
+}
+
+
+static void UndoPredictUp(GlyphSheet *sheet) {
+    for (int y = 1; y < sheet->height; y++) {
+        u64 *row = sheet->Row(y);
+        const u64 *above = sheet->Row(y - 1);
+        for (int j = 0; j < sheet->stride; j++) {
+            row[j] ^= above[j];
+        }
+    }
+}
+
+
+// Each pixel is XORed with the one to its left. Going right to left means
+// the word below j is still unmodified when its top bit is carried in.
+static void PredictLeft(GlyphSheet *sheet) {
+    for (int y = 0; y < sheet->height; y++) {
+        u64 *row = sheet->Row(y);
+        for (int j = sheet->stride - 1; j >= 0; j--) {
+            u64 carry = j > 0 ? row[j - 1] >> 63 : 0;
+            row[j] ^= (row[j] << 1) | carry;
+        }
+        ClearPastWidth(sheet, row);
+    }
+}
+
+
+// A prefix XOR of each row. Within a word it takes six shift and XOR
+// steps. The last pixel of the previous word then flips the whole word.
+static void UndoPredictLeft(GlyphSheet *sheet) {
+    for (int y = 0; y < sheet->height; y++) {
+        u64 *row = sheet->Row(y);
+        u64 prev_pixel = 0;
+        for (int j = 0; j < sheet->stride; j++) {
+            u64 w = row[j];
+            w ^= w << 1;
+            w ^= w << 2;
+            w ^= w << 4;
+            w ^= w << 8;
+            w ^= w << 16;
+            w ^= w << 32;
+            if (prev_pixel) {
+                w = ~w;
+            }
+            row[j] = w;
+            prev_pixel = w >> 63;
+        }
+        ClearPastWidth(sheet, row);
+    }
+}
+
+
+// Each cell is XORed with the cell to its left, as it was before
+// prediction, which is the whole row shifted right by cell_width.
+static void PredictPrevGlyph(GlyphSheet *sheet, int cell_width, Arena *arena) {
+    if (cell_width == 0 || cell_width >= sheet->width) {
+        return;
+    }
+
+    u64 *shifted = (u64 *)arena->Alloc(sheet->stride * sizeof(u64));
+    for (int y = 0; y < sheet->height; y++) {
+        u64 *row = sheet->Row(y);
+        memset(shifted, 0, sheet->stride * sizeof(u64));
+        CopyBits(shifted, cell_width, row, 0, sheet->width - cell_width);
+        for (int j = 0; j < sheet->stride; j++) {
+            row[j] ^= shifted[j];
+        }
+    }
+}
+
+
+// Left to right a cell at a time, so that each cell is XORed with the
+// already restored cell before it.
+static void UndoPredictPrevGlyph(GlyphSheet *sheet, int cell_width, Arena *arena) {
+    if (cell_width == 0 || cell_width >= sheet->width) {
+        return;
+    }
+
+    u64 *prev_cell = (u64 *)arena->Alloc(sheet->stride * sizeof(u64));
+    for (int y = 0; y < sheet->height; y++) {
+        u64 *row = sheet->Row(y);
+        for (int x = cell_width; x < sheet->width; x += cell_width) {
+            int num_bits = sheet->width - x < cell_width ? sheet->width - x : cell_width;
+            memset(prev_cell, 0, sheet->stride * sizeof(u64));
+            CopyBits(prev_cell, x, row, x - cell_width, num_bits);
+            for (int j = x >> 6; j <= (x + num_bits - 1) >> 6; j++) {
+                row[j] ^= prev_cell[j];
+            }
+        }
+    }
+}
+
+
+void ApplyPredictor(GlyphSheet *sheet, int predictor, int cell_width, Arena *arena) {
+    if (predictor == PREDICT_UP) {
+        PredictUp(sheet);
+    }
+    else if (predictor == PREDICT_LEFT) {
+        PredictLeft(sheet);
+    }
+    else if (predictor == PREDICT_PREV_GLYPH) {
+        PredictPrevGlyph(sheet, cell_width, arena);
+    }
+}
+
+
+void UndoPredictor(GlyphSheet *sheet, int predictor, int cell_width, Arena *arena) {
+    if (predictor == PREDICT_UP) {
+        UndoPredictUp(sheet);
+    }
+    else if (predictor == PREDICT_LEFT) {
+        UndoPredictLeft(sheet);
+    }
+    else if (predictor == PREDICT_PREV_GLYPH) {
+        UndoPredictPrevGlyph(sheet, cell_width, arena);
+    }
+}
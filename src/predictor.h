@@ -0,0 +1,24 @@
+#pragma once
+
+#include "glyph_sheet.h"
+
+struct Arena;
+
+
+// Predictors turn a glyph sheet into residuals that run length encode
+// better, and back again. Each is stored in the predictor bits of a .dfbf
+// font blob's flags byte, so the numbers must not change. PREDICT_UP is 0
+// because that was the only predictor before the flags said which.
+enum {
+    PREDICT_UP,                     // XOR with the row above.
+    PREDICT_NONE,
+    PREDICT_LEFT,                   // XOR with the pixel to the left.
+    PREDICT_PREV_GLYPH,             // XOR with the glyph one cell to the left.
+    NUM_PREDICTORS
+};
+
+// cell_width is only used by PREDICT_PREV_GLYPH, which also takes a scratch
+// row from arena. The first pixel, row or cell of the sheet, which has
+// nothing to predict from, is stored as is.
+void ApplyPredictor(GlyphSheet *sheet, int predictor, int cell_width, Arena *arena);
+void UndoPredictor(GlyphSheet *sheet, int predictor, int cell_width, Arena *arena);
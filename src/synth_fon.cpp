@@ -0,0 +1,250 @@
+#include "synth_fon.h"
+
+#include "converter.h"
+
+#include <string.h>
+#include <vector>
+
+
+// Resources are aligned to 256 bytes, so that families of many sizes are
+// still in reach of the resource table's 16-bit offsets.
+static const int ALIGNMENT_SHIFT = 8;
+
+
+// A small fixed generator, rather than rand(), so that the fonts are the
+// same with every C runtime.
+struct SynthRandom {
+    u32 state;
+
+    SynthRandom(u32 seed) {
+        state = seed * 2654435761u + 1;
+    }
+
+    u32 Next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // In [0, n).
+    int Below(int n) {
+        return (int)(Next() % (u32)n);
+    }
+};
+
+
+template <typename T>
+static T *PutStruct(std::vector<u8> *file, size_t offset) {
+    if (file->size() < offset + sizeof(T)) {
+        file->resize(offset + sizeof(T), 0);
+    }
+    return (T *)&(*file)[offset];
+}
+
+
+// Fills in one glyph's bitmap, which is stored a column of 8 pixels at a time,
+// each column pix_height bytes, with the leftmost pixel in the top bit.
+static void MakeGlyphBitmap(u8 *bitmap, int pix_width, int pix_height, int pattern, int c,
+                            SynthRandom *rnd) {
+    int num_columns = (pix_width + 7) / 8;
+    memset(bitmap, 0, num_columns * pix_height);
+
+    if (pattern == SYNTH_RANDOM) {
+        for (int i = 0; i < num_columns * pix_height; i++) {
+            bitmap[i] = rnd->Next() >> 24;
+        }
+    }
+    else if (pattern == SYNTH_CHECKER) {
+        for (int column = 0; column < num_columns; column++) {
+            for (int y = 0; y < pix_height; y++) {
+                bitmap[column * pix_height + y] = (y & 1) ? 0x55 : 0xaa;
+            }
+        }
+    }
+    else if (pattern == SYNTH_SHAPES || (pattern == SYNTH_SPARSE && c % 37 == 0)) {
+        int num_rects = 1 + rnd->Below(3);
+        for (int r = 0; r < num_rects && pix_width > 0; r++) {
+            int x0 = rnd->Below(pix_width);
+            int x1 = x0 + 1 + rnd->Below(pix_width - x0);
+            int y0 = rnd->Below(pix_height);
+            int y1 = y0 + 1 + rnd->Below(pix_height - y0);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    bitmap[(x / 8) * pix_height + y] |= 0x80 >> (x % 8);
+                }
+            }
+        }
+    }
+
+    // Clear the pixels past pix_width in the last column, as real fonts do.
+    int spare = num_columns * 8 - pix_width;
+    if (num_columns > 0 && spare > 0) {
+        u8 mask = (u8)(0xff << spare);
+        for (int y = 0; y < pix_height; y++) {
+            bitmap[(num_columns - 1) * pix_height + y] &= mask;
+        }
+    }
+}
+
+
+// Appends one FONT resource to the end of file, aligned, and returns its
+// offset.
+static size_t AppendFntResource(std::vector<u8> *file, SynthFonParams const &params, int pix_height,
+                                SynthRandom *rnd) {
+    int num_chars = params.last_char - params.first_char + 1;
+    bool is_fnt3 = params.fnt_version == 0x300;
+    size_t hdr_num_bytes = is_fnt3 ? sizeof(FntHeader3) : sizeof(FntHeader);
+    size_t glyph_num_bytes = is_fnt3 ? sizeof(_Glyph3) : sizeof(_Glyph);
+    size_t bitmaps_start = hdr_num_bytes + (num_chars + 1) * glyph_num_bytes;
+
+    // In version 0x200, every glyph bitmap must start below 64K, as the
+    // offsets are 16-bit.
+    int max_width = (pix_height * 11 + 10) / 20;
+    if (max_width < 1) {
+        max_width = 1;
+    }
+    if (max_width > 255) {
+        max_width = 255;
+    }
+    while (!is_fnt3 && max_width > 1 &&
+           bitmaps_start + num_chars * ((max_width + 7) / 8) * pix_height > 0xffff) {
+        max_width--;
+    }
+
+    size_t alignment = (size_t)1 << ALIGNMENT_SHIFT;
+    size_t fnt_offset = (file->size() + alignment - 1) & ~(alignment - 1);
+    size_t glyph_table_offset = fnt_offset + hdr_num_bytes;
+    size_t bitmaps_offset = fnt_offset + bitmaps_start;
+    file->resize(bitmaps_offset, 0);
+
+    u32 bitmap_pos = 0;
+    std::vector<u8> bitmap;
+    for (int c = 0; c < num_chars + 1; c++) {
+        int pix_width = max_width;
+        if (params.proportional) {
+            pix_width = 1 + rnd->Below(max_width);
+        }
+        if (c == num_chars) {
+            // The extra entry at the end is a zero width sentinel.
+            pix_width = 0;
+        }
+
+        int num_bytes = (pix_width + 7) / 8 * pix_height;
+        bitmap.resize(num_bytes + 1);
+        MakeGlyphBitmap(&bitmap[0], pix_width, pix_height, params.pattern, c, rnd);
+        file->insert(file->end(), bitmap.begin(), bitmap.begin() + num_bytes);
+
+        size_t glyph_offset = glyph_table_offset + c * glyph_num_bytes;
+        if (is_fnt3) {
+            _Glyph3 *glyph = PutStruct<_Glyph3>(file, glyph_offset);
+            glyph->pix_width = pix_width;
+            glyph->bitmap_offset = (u32)(bitmaps_start + bitmap_pos);
+        }
+        else {
+            _Glyph *glyph = PutStruct<_Glyph>(file, glyph_offset);
+            glyph->pix_width = pix_width;
+            glyph->bitmap_offset = (u16)(bitmaps_start + bitmap_pos);
+        }
+        bitmap_pos += num_bytes;
+    }
+
+    const char name[] = "Synthetic";
+    size_t name_offset = file->size() - fnt_offset;
+    file->insert(file->end(), name, name + sizeof(name));
+    size_t fnt_num_bytes = file->size() - fnt_offset;
+
+    if (is_fnt3) {
+        FntHeader3 *hdr3 = PutStruct<FntHeader3>(file, fnt_offset);
+        hdr3->flags = FNT3_FLAG_1_COLOUR;
+        hdr3->flags |= params.proportional ? FNT3_FLAG_PROPORTIONAL : FNT3_FLAG_FIXED;
+    }
+
+    FntHeader *hdr = PutStruct<FntHeader>(file, fnt_offset);
+    hdr->version = params.fnt_version;
+    hdr->size[0] = fnt_num_bytes & 0xffff;
+    hdr->size[1] = (u16)(fnt_num_bytes >> 16);
+    hdr->point_size = pix_height * 3 / 4;
+    hdr->vert_dpi = 96;
+    hdr->hori_dpi = 96;
+    hdr->ascent = pix_height * 4 / 5;
+    hdr->weight = 400;
+    hdr->pix_width = params.proportional ? 0 : max_width;
+    hdr->pix_height = pix_height;
+    hdr->avg_width = max_width;
+    hdr->max_width = max_width;
+    hdr->first_char = params.first_char;
+    hdr->last_char = params.last_char;
+    hdr->default_char = 0;
+    hdr->name_offset = (u32)name_offset;
+    hdr->bitmap_offset = (u32)(bitmaps_offset - fnt_offset);
+
+    return fnt_offset;
+}
+
+
+void MakeSynthFon(MemBuf *out, SynthFonParams const &params) {
+    ReleaseAssert(params.num_sizes >= 1 && params.num_sizes <= MAX_FNTS_PER_FILE,
+        "Synthetic fonts need 1 to %d sizes", MAX_FNTS_PER_FILE);
+    ReleaseAssert(params.first_char <= params.last_char, "Synthetic fonts need a char range");
+    ReleaseAssert(params.fnt_version == 0x200 || params.fnt_version == 0x300,
+        "Synthetic fonts are version 0x200 or 0x300");
+
+    SynthRandom rnd(params.seed);
+    std::vector<u8> file;
+
+    // The new exe header goes straight after the old one.
+    OldExeHeader *old_hdr = PutStruct<OldExeHeader>(&file, 0);
+    old_hdr->id[0] = 'M';
+    old_hdr->id[1] = 'Z';
+    old_hdr->num_paragraphs_in_header = 0;
+    size_t new_hdr_offset = sizeof(OldExeHeader);
+    old_hdr->new_exe_header_offset = (u32)new_hdr_offset;
+
+    // The resource table: the shift, a FONTDIR block with one item, a FONT
+    // block with an item per size, and the terminating block.
+    NewExeHeader *new_hdr = PutStruct<NewExeHeader>(&file, new_hdr_offset);
+    new_hdr->id[0] = 'N';
+    new_hdr->id[1] = 'E';
+    new_hdr->res_table_offset = sizeof(NewExeHeader);
+
+    size_t offset = new_hdr_offset + sizeof(NewExeHeader);
+    PutStruct<ResorceTable>(&file, offset)->alignment_shift_amount = ALIGNMENT_SHIFT;
+    offset += sizeof(ResorceTable);
+
+    ResourceTableBlock *block = PutStruct<ResourceTableBlock>(&file, offset);
+    block->type_id = 0x8007;
+    block->num_of_this_type = 1;
+    offset += sizeof(ResourceTableBlock);
+    PutStruct<ResourceTableItem>(&file, offset)->resource_id = 0;
+    offset += sizeof(ResourceTableItem);
+
+    block = PutStruct<ResourceTableBlock>(&file, offset);
+    block->type_id = 0x8008;
+    block->num_of_this_type = params.num_sizes;
+    offset += sizeof(ResourceTableBlock);
+    size_t items_offset = offset;
+    offset += params.num_sizes * sizeof(ResourceTableItem);
+
+    PutStruct<ResourceTableBlock>(&file, offset);
+    offset += sizeof(ResourceTableBlock);
+
+    for (int i = 0; i < params.num_sizes; i++) {
+        int pix_height = params.min_height;
+        if (params.num_sizes > 1) {
+            pix_height += (params.max_height - params.min_height) * i / (params.num_sizes - 1);
+        }
+
+        size_t fnt_offset = AppendFntResource(&file, params, pix_height, &rnd);
+        size_t fnt_num_bytes = file.size() - fnt_offset;
+        ReleaseAssert(file.size() >> ALIGNMENT_SHIFT <= 0xffff,
+            "Synthetic font is too big for the resource table");
+        ResourceTableItem *item = PutStruct<ResourceTableItem>(&file, items_offset + i * sizeof(ResourceTableItem));
+        item->data_offset = (u16)(fnt_offset >> ALIGNMENT_SHIFT);
+        item->num_bytes = (u16)((fnt_num_bytes + (1 << ALIGNMENT_SHIFT) - 1) >> ALIGNMENT_SHIFT);
+        item->resource_id = 0x8001 + i;
+    }
+
+    out->Reset();
+    out->PushBytes(&file[0], (int)file.size());
+}
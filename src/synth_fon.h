@@ -0,0 +1,48 @@
+#pragma once
+
+#include "mem_buf.h"
+#include "windows_fnt.h"
+
+
+// Builds .fon files from scratch, using the structs in windows_fnt.h, so
+// that the benchmark has inputs of known shape that are the same on every
+// machine. Only the fields the converter reads are filled in.
+
+// What the glyph bitmaps contain.
+enum {
+    SYNTH_RANDOM,                   // Random pixels. Mostly short runs, like small text fonts.
+    SYNTH_SHAPES,                   // Random filled rects on blank glyphs, like large fonts.
+    SYNTH_CHECKER,                  // Alternating pixels. Every run has length 1.
+    SYNTH_SPARSE                    // Nearly every glyph blank, so the runs need long escapes.
+};
+
+
+struct SynthFonParams {
+    int num_sizes;                  // FONT resources, at most MAX_FNTS_PER_FILE.
+    int min_height;                 // Sizes are spread evenly over [min_height, max_height].
+    int max_height;
+    int first_char;
+    int last_char;
+    bool proportional;              // Random glyph widths up to the size's max_width.
+    int pattern;                    // SYNTH_*.
+    u32 seed;
+    int fnt_version;                // 0x200, or 0x300 for 32-bit glyph offsets.
+
+    SynthFonParams() {
+        num_sizes = 1;
+        min_height = 13;
+        max_height = 13;
+        first_char = 0x20;
+        last_char = 0xff;
+        proportional = false;
+        pattern = SYNTH_RANDOM;
+        seed = 1;
+        fnt_version = 0x200;
+    }
+};
+
+
+// Replaces the contents of out with the .fon. Each size's max_width is
+// about 55% of its height, limited to 255 and, for version 0x200, so that
+// the bitmaps fit its 16-bit offsets.
+void MakeSynthFon(MemBuf *out, SynthFonParams const &params);
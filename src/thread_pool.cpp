@@ -0,0 +1,203 @@
+#include "thread_pool.h"
+
+
+ThreadPool::ThreadPool(int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = std::thread::hardware_concurrency();
+        if (num_threads <= 0) {
+            num_threads = 1;
+        }
+    }
+
+    next_queue = 0;
+    num_pending = 0;
+    num_pushes = 0;
+    shutting_down = false;
+
+    for (int i = 0; i < num_threads; i++) {
+        queues.push_back(new WorkerQueue);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        threads.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        shutting_down = true;
+    }
+    wake.notify_all();
+
+    for (unsigned i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    for (unsigned i = 0; i < queues.size(); i++) {
+        delete queues[i];
+    }
+}
+
+
+void ThreadPool::Push(Task task) {
+    // Spread new tasks round robin. Stealing evens out whatever imbalance
+    // this leaves.
+    QueuedTask queued = { task, NULL };
+    PushToQueue(queued, (unsigned)next_queue++ % queues.size());
+}
+
+
+void ThreadPool::Push(Task task, TaskGroup *group, int worker_index) {
+    group->num_pending++;
+    QueuedTask queued = { task, group };
+    if (worker_index >= 0) {
+        PushToQueue(queued, worker_index);
+    }
+    else {
+        PushToQueue(queued, (unsigned)next_queue++ % queues.size());
+    }
+}
+
+
+void ThreadPool::PushToQueue(QueuedTask const &queued, int queue_index) {
+    num_pending++;
+    {
+        std::lock_guard<std::mutex> guard(queues[queue_index]->lock);
+        queues[queue_index]->tasks.push_back(queued);
+    }
+
+    // Count the push under wake_lock so that it can't slip in between a
+    // worker finding no work and it starting to wait. A worker waiting for a
+    // group is woken too, in case the task is one it should run.
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        num_pushes++;
+    }
+    wake.notify_one();
+    if (queued.group) {
+        all_done.notify_all();
+    }
+}
+
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> guard(wake_lock);
+    while (num_pending > 0) {
+        all_done.wait(guard);
+    }
+}
+
+
+void ThreadPool::WaitForGroup(TaskGroup *group, int worker_index) {
+    while (group->num_pending > 0) {
+        unsigned seen_pushes = num_pushes;
+        if (worker_index >= 0 && RunGroupTask(group, worker_index)) {
+            continue;
+        }
+
+        // The rest of the group is running on other workers. Sleep until it
+        // finishes or, for a worker, until a task is pushed that might be
+        // one of the group's.
+        std::unique_lock<std::mutex> guard(wake_lock);
+        all_done.wait(guard, [&] {
+            return group->num_pending == 0 || (worker_index >= 0 && num_pushes != seen_pushes);
+        });
+    }
+}
+
+
+void ThreadPool::RunTask(QueuedTask const &queued, int queue_index) {
+    queued.task(queue_index);
+
+    bool signal = false;
+    if (queued.group && --queued.group->num_pending == 0) {
+        signal = true;
+    }
+    if (--num_pending == 0) {
+        signal = true;
+    }
+    if (signal) {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        all_done.notify_all();
+    }
+}
+
+
+bool ThreadPool::RunOneTask(int queue_index) {
+    QueuedTask queued;
+    bool found = false;
+    int num_queues = queues.size();
+
+    // Own queue first, newest task first. Then steal the oldest task from
+    // each of the others in turn.
+    for (int i = 0; i < num_queues && !found; i++) {
+        WorkerQueue *queue = queues[(queue_index + i) % num_queues];
+        std::lock_guard<std::mutex> guard(queue->lock);
+        if (!queue->tasks.empty()) {
+            if (i == 0) {
+                queued = queue->tasks.back();
+                queue->tasks.pop_back();
+            }
+            else {
+                queued = queue->tasks.front();
+                queue->tasks.pop_front();
+            }
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    RunTask(queued, queue_index);
+    return true;
+}
+
+
+bool ThreadPool::RunGroupTask(TaskGroup *group, int queue_index) {
+    QueuedTask queued;
+    bool found = false;
+    int num_queues = queues.size();
+
+    // Same order as RunOneTask, but skipping tasks in other groups. The
+    // group's tasks are usually at the back of the own queue.
+    for (int i = 0; i < num_queues && !found; i++) {
+        WorkerQueue *queue = queues[(queue_index + i) % num_queues];
+        std::lock_guard<std::mutex> guard(queue->lock);
+        std::deque<QueuedTask> &tasks = queue->tasks;
+        for (unsigned j = 0; j < tasks.size() && !found; j++) {
+            unsigned k = i == 0 ? tasks.size() - 1 - j : j;
+            if (tasks[k].group == group) {
+                queued = tasks[k];
+                tasks.erase(tasks.begin() + k);
+                found = true;
+            }
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    RunTask(queued, queue_index);
+    return true;
+}
+
+
+void ThreadPool::WorkerMain(int queue_index) {
+    while (1) {
+        unsigned seen_pushes = num_pushes;
+        if (RunOneTask(queue_index)) {
+            continue;
+        }
+
+        // Any task pushed since seen_pushes was read may have been missed,
+        // so only sleep if there hasn't been one.
+        std::unique_lock<std::mutex> guard(wake_lock);
+        if (shutting_down) {
+            break;
+        }
+        wake.wait(guard, [&] { return shutting_down || num_pushes != seen_pushes; });
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Tasks are passed the index of the worker running them, in
+// [0, NumThreads()), so they can use per-worker scratch buffers.
+typedef std::function<void(int worker_index)> Task;
+
+
+// Counts the unfinished tasks pushed with it, so that a task can push
+// subtasks and wait for just those.
+struct TaskGroup {
+    std::atomic<int> num_pending;
+
+    TaskGroup() {
+        num_pending = 0;
+    }
+};
+
+
+// A fixed set of worker threads, each with its own task queue. Workers take
+// from the back of their own queue and, when that's empty, steal from the
+// front of the others. That keeps the threads busy when some inputs take much
+// longer than others, without a single contended queue.
+struct ThreadPool {
+    struct QueuedTask {
+        Task task;
+        TaskGroup *group;           // Can be NULL.
+    };
+
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<QueuedTask> tasks;
+    };
+
+    std::vector<WorkerQueue *> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> next_queue;
+    std::atomic<int> num_pending;      // Pushed but not yet finished.
+    std::atomic<unsigned> num_pushes;  // Only changed with wake_lock held. Tells waiters there may be new work.
+
+    std::mutex wake_lock;
+    std::condition_variable wake;      // Signalled when a task is pushed or on shutdown.
+    std::condition_variable all_done;  // Signalled when num_pending or a group's reaches 0, or a group task is pushed.
+    bool shutting_down;
+
+    // num_threads <= 0 means one per hardware thread.
+    ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    int NumThreads() const { return (int)threads.size(); }
+
+    void Push(Task task);
+
+    // Pushes a task in group. worker_index is the worker pushing it, or -1
+    // for a thread outside the pool. A worker's subtasks go on its own
+    // queue, so that it picks them up first when it waits for them, and the
+    // other workers only steal them once there is nothing older to do.
+    void Push(Task task, TaskGroup *group, int worker_index);
+
+    // Blocks until every pushed task has finished.
+    void Wait();
+
+    // Blocks until every task in group has finished. A worker waiting on a
+    // group runs the group's tasks itself, rather than sitting idle, but
+    // never any other task, so waits can't nest. Tasks it runs are passed
+    // its worker_index. A thread outside the pool just blocks.
+    void WaitForGroup(TaskGroup *group, int worker_index);
+
+    // Pops a task from queue_index's queue or steals one from another queue.
+    // Returns false if there was no work anywhere.
+    bool RunOneTask(int queue_index);
+
+    // Like RunOneTask, but only takes tasks in group.
+    bool RunGroupTask(TaskGroup *group, int queue_index);
+
+    void PushToQueue(QueuedTask const &queued, int queue_index);
+    void RunTask(QueuedTask const &queued, int queue_index);
+
+    void WorkerMain(int queue_index);
+};
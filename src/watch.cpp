@@ -0,0 +1,409 @@
+#include "watch.h"
+
+#include "batch.h"
+#include "cache.h"
+#include "output_writer.h"
+#include "thread_pool.h"
+
+#include "df_time.h"
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+
+struct WatchedFile {
+    FontBlobCache font_cache;       // The blobs of this file's fonts, as last converted.
+    u64 stamp;                      // Size and modification time when last converted.
+    bool ok;
+    std::string error;
+    int num_fnts;                   // Distinct fonts in the file.
+    int num_encoded;                // Fonts that changed, and so were encoded, last time.
+    double seconds;                 // Time the last conversion took.
+    double converted_at;            // Seconds since watching started.
+    int num_conversions;
+
+    WatchedFile() {
+        stamp = 0;
+        ok = false;
+        num_fnts = 0;
+        num_encoded = 0;
+        seconds = 0.0;
+        converted_at = 0.0;
+        num_conversions = 0;
+    }
+};
+
+
+// Changes whenever the file is written. 0 if it doesn't exist.
+static u64 GetFileStamp(const char *path) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attribs;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attribs)) {
+        return 0;
+    }
+    u64 time = ((u64)attribs.ftLastWriteTime.dwHighDateTime << 32) | attribs.ftLastWriteTime.dwLowDateTime;
+    u64 size = ((u64)attribs.nFileSizeHigh << 32) | attribs.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+    // In nanoseconds, as two saves can easily be within the same second.
+#ifdef __APPLE__
+    u64 time = (u64)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    u64 time = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    u64 size = (u64)st.st_size;
+#endif
+    return (time * 0x9e3779b97f4a7c15ULL) ^ size ^ 1;
+}
+
+
+struct Watcher {
+    ConvertOptions opts;
+    const char *status_path;
+    ThreadPool pool;
+    ConvertContext ctx;
+    std::map<std::string, WatchedFile> files;
+    double start_time;
+    int num_conversions;
+
+    Watcher(ConvertOptions const &_opts, int num_threads, const char *_status_path)
+        : pool(num_threads) {
+        // Editors truncate and rewrite the files we watch, maybe while we
+        // are converting them.
+        opts = _opts;
+        opts.copy_input = true;
+        status_path = _status_path;
+        ctx.pool = &pool;
+        start_time = GetRealTime();
+        num_conversions = 0;
+    }
+
+    void Convert(std::string const &path);
+    void Forget(std::string const &path);
+    void WriteStatus();
+};
+
+
+void Watcher::Convert(std::string const &path) {
+    WatchedFile *file = &files[path];
+
+    ctx.font_cache = &file->font_cache;
+    ConvertError err;
+    double start = GetRealTime();
+    file->stamp = GetFileStamp(path.c_str());
+    file->ok = ConvertFile(path.c_str(), opts, &ctx, &err);
+    file->seconds = GetRealTime() - start;
+    PrintWarnings(path.c_str(), ctx);
+    ctx.font_cache = NULL;
+
+    file->num_encoded = ctx.num_fnts_encoded;
+    file->converted_at = start - start_time;
+    file->num_conversions++;
+    num_conversions++;
+    if (file->ok) {
+        // Forget the fonts the file no longer has, so that a long session of
+        // edits doesn't keep every version of every font.
+        file->font_cache.PruneUnused();
+        file->num_fnts = file->font_cache.entries.size();
+        file->error.clear();
+        printf("%s: %.1f ms, %d of %d fonts encoded\n", path.c_str(), file->seconds * 1000.0,
+               file->num_encoded, file->num_fnts);
+        fflush(stdout);
+    }
+    else {
+        file->error = err.msg;
+        fprintf(stderr, "%s: %s\n", path.c_str(), err.msg);
+    }
+
+    WriteStatus();
+}
+
+
+void Watcher::Forget(std::string const &path) {
+    if (files.erase(path)) {
+        printf("%s: removed\n", path.c_str());
+        fflush(stdout);
+        WriteStatus();
+    }
+}
+
+
+// Written whole and renamed into place, so whatever polls it never sees a
+// partial update.
+void Watcher::WriteStatus() {
+    if (!status_path) {
+        return;
+    }
+
+    int num_failed = 0;
+    std::map<std::string, WatchedFile>::const_iterator it;
+    for (it = files.begin(); it != files.end(); ++it) {
+        if (!it->second.ok) {
+            num_failed++;
+        }
+    }
+
+    MemBuf buf;
+    buf.Printf("{\n");
+    buf.Printf("  \"uptime_seconds\": %.3f,\n", GetRealTime() - start_time);
+    buf.Printf("  \"conversions\": %d,\n", num_conversions);
+    buf.Printf("  \"watching\": %d,\n", (int)files.size());
+    buf.Printf("  \"failed\": %d,\n", num_failed);
+    buf.Printf("  \"files\": [");
+    for (it = files.begin(); it != files.end(); ++it) {
+        WatchedFile const &file = it->second;
+        buf.Printf("%s\n    { \"file\": ", it == files.begin() ? "" : ",");
+        PushJsonString(&buf, it->first.c_str());
+        buf.Printf(", \"ok\": %s, \"error\": ", file.ok ? "true" : "false");
+        PushJsonString(&buf, file.error.c_str());
+        buf.Printf(", \"fonts\": %d, \"fonts_encoded\": %d, \"ms\": %.3f,"
+            " \"converted_at\": %.3f, \"conversions\": %d }",
+            file.num_fnts, file.num_encoded, file.seconds * 1000.0,
+            file.converted_at, file.num_conversions);
+    }
+    buf.Printf("\n  ]\n}\n");
+
+    ConvertError err;
+    if (!ReplaceArtifact(status_path, &buf, true, &err)) {
+        fprintf(stderr, "%s\n", err.msg);
+    }
+}
+
+
+// Checks every input's stamp, converting those that are new or changed and
+// forgetting those that are gone. Used where there is no inotify.
+static void PollForever(Watcher *watcher, std::vector<std::string> const &paths) {
+    while (1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_POLL_MS));
+
+        std::vector<std::string> inputs;
+        for (unsigned i = 0; i < paths.size(); i++) {
+            CollectInputs(paths[i].c_str(), &inputs);
+        }
+
+        std::set<std::string> present;
+        for (unsigned i = 0; i < inputs.size(); i++) {
+            present.insert(inputs[i]);
+            std::map<std::string, WatchedFile>::iterator it = watcher->files.find(inputs[i]);
+            if (it == watcher->files.end() || it->second.stamp != GetFileStamp(inputs[i].c_str())) {
+                watcher->Convert(inputs[i]);
+            }
+        }
+
+        std::vector<std::string> gone;
+        std::map<std::string, WatchedFile>::iterator it;
+        for (it = watcher->files.begin(); it != watcher->files.end(); ++it) {
+            if (!present.count(it->first)) {
+                gone.push_back(it->first);
+            }
+        }
+        for (unsigned i = 0; i < gone.size(); i++) {
+            watcher->Forget(gone[i]);
+        }
+    }
+}
+
+
+#ifdef __linux__
+
+// A watched directory. Paths of files in it are dir + "/" + name, or just
+// name for the current directory, to match what CollectInputs() gives.
+struct WatchedDir {
+    std::string path;
+    bool whole_dir;                 // False if it is only watched for input files named in it.
+};
+
+
+static std::string JoinPath(std::string const &dir, const char *name) {
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+
+// Watches dir, and if whole_dir, every directory below it too.
+static void AddWatches(int fd, std::string const &dir, bool whole_dir,
+                       std::map<int, WatchedDir> *dirs) {
+    u32 mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE;
+    int wd = inotify_add_watch(fd, dir.empty() ? "." : dir.c_str(), mask);
+    if (wd < 0) {
+        fprintf(stderr, "Couldn't watch '%s'\n", dir.empty() ? "." : dir.c_str());
+        return;
+    }
+    WatchedDir *watched = &(*dirs)[wd];
+    watched->path = dir;
+    watched->whole_dir = whole_dir;
+    if (!whole_dir) {
+        return;
+    }
+
+    DIR *handle = opendir(dir.c_str());
+    if (!handle) {
+        return;
+    }
+    while (struct dirent *entry = readdir(handle)) {
+        const char *name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        // Like CollectInputs(), links to directories aren't followed.
+        std::string child = JoinPath(dir, name);
+        struct stat st;
+        if (lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            AddWatches(fd, child, true, dirs);
+        }
+    }
+    closedir(handle);
+}
+
+
+struct InotifyWatches {
+    int fd;
+    std::map<int, WatchedDir> dirs;
+    std::set<std::string> named_files;      // Inputs given as files, not directories.
+
+    InotifyWatches() {
+        fd = -1;
+    }
+
+    bool Start(std::vector<std::string> const &paths);
+    bool WatchForever(Watcher *watcher);
+};
+
+
+// Watches the inputs' directories. Returns false if inotify can't be used.
+bool InotifyWatches::Start(std::vector<std::string> const &paths) {
+    fd = inotify_init();
+    if (fd < 0) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < paths.size(); i++) {
+        std::string const &path = paths[i];
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            AddWatches(fd, path, true, &dirs);
+            continue;
+        }
+
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : path.substr(0, slash);
+        named_files.insert(path);
+        AddWatches(fd, dir, false, &dirs);
+    }
+    return true;
+}
+
+
+// Waits for inotify events and handles them a read at a time. A save usually
+// comes as several events, so the files they name are only converted once
+// the whole read has been looked at. Returns false if reading the events
+// fails.
+bool InotifyWatches::WatchForever(Watcher *watcher) {
+    // Aligned for the inotify_event structs.
+    u64 events[4096 / sizeof(u64)];
+    while (1) {
+        ssize_t num_bytes = read(fd, events, sizeof(events));
+        if (num_bytes <= 0) {
+            close(fd);
+            return false;
+        }
+
+        std::set<std::string> changed;
+        for (char *p = (char *)events; p < (char *)events + num_bytes; ) {
+            inotify_event *event = (inotify_event *)p;
+            p += sizeof(inotify_event) + event->len;
+
+            std::map<int, WatchedDir>::iterator dir = dirs.find(event->wd);
+            if (dir == dirs.end() || event->len == 0) {
+                continue;
+            }
+            std::string path = JoinPath(dir->second.path, event->name);
+
+            if (event->mask & IN_ISDIR) {
+                // A new directory in a watched tree may already have .fon
+                // files in it by the time it is watched.
+                if (dir->second.whole_dir && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    AddWatches(fd, path, true, &dirs);
+                    std::vector<std::string> inputs;
+                    CollectInputs(path.c_str(), &inputs);
+                    changed.insert(inputs.begin(), inputs.end());
+                }
+                continue;
+            }
+
+            if (!HasFonExtension(event->name)) {
+                continue;
+            }
+            if (!dir->second.whole_dir && !named_files.count(path)) {
+                continue;
+            }
+
+            if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                changed.insert(path);
+            }
+            else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changed.erase(path);
+                watcher->Forget(path);
+            }
+        }
+
+        std::set<std::string>::iterator it;
+        for (it = changed.begin(); it != changed.end(); ++it) {
+            watcher->Convert(*it);
+        }
+    }
+}
+
+#endif
+
+
+int RunWatch(std::vector<std::string> const &paths, ConvertOptions const &opts, int num_threads,
+             const char *status_path) {
+    Watcher watcher(opts, num_threads, status_path);
+
+#ifdef __linux__
+    // Watch before the first conversions, so that a save made while they run
+    // isn't missed. Polling needs nothing like this, as each file's stamp is
+    // taken before it is converted.
+    InotifyWatches inotify;
+    bool use_inotify = inotify.Start(paths);
+#endif
+
+    std::vector<std::string> inputs;
+    for (unsigned i = 0; i < paths.size(); i++) {
+        CollectInputs(paths[i].c_str(), &inputs);
+    }
+    for (unsigned i = 0; i < inputs.size(); i++) {
+        watcher.Convert(inputs[i]);
+    }
+    watcher.WriteStatus();
+    printf("Watching %d files\n", (int)watcher.files.size());
+    fflush(stdout);
+
+#ifdef __linux__
+    if (use_inotify && inotify.WatchForever(&watcher)) {
+        return 0;
+    }
+    fprintf(stderr, "Couldn't use inotify. Polling instead.\n");
+#endif
+    PollForever(&watcher, paths);
+    return 0;
+}
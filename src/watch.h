@@ -0,0 +1,23 @@
+#pragma once
+
+#include "converter.h"
+
+#include <string>
+#include <vector>
+
+
+// Watch mode, for iterating on fonts. Converts every input, then keeps
+// running and converts each .fon again as soon as it is written. Inputs that
+// are directories also pick up new .fon files. Each file's encoded fonts are
+// kept in memory, so an edit only re-encodes the fonts whose FONT resources
+// changed, and the outputs are replaced atomically.
+//
+// Directories are watched with inotify on Linux, and the inputs polled every
+// WATCH_POLL_MS elsewhere. If status_path isn't NULL, a JSON summary of every
+// watched file is written there after each conversion, for tools to query.
+// Never returns.
+
+enum { WATCH_POLL_MS = 50 };
+
+int RunWatch(std::vector<std::string> const &paths, ConvertOptions const &opts, int num_threads,
+             const char *status_path);
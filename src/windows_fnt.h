@@ -6,8 +6,14 @@
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 
+// These are all read in place from the file, by ByteView::Get(), at offsets
+// that are often only 2-byte aligned. So they are packed, which also makes
+// their layout the same as the file's.
+#pragma pack(push, 1)
+
 // First 0x40 bytes of file.
 struct OldExeHeader {
     u8 id[2];                       // "MZ"
@@ -106,14 +112,19 @@ struct ResorceTable {
 
 
 // Starts at 0x140
-#pragma pack(push, 1)
 struct _Glyph {
     u16 pix_width;
-    u16 bitmap_offset;
+    u16 bitmap_offset;              // From the start of the FONT resource.
+};
+
+// The 3.0 glyph entry, for fonts bigger than 64K.
+struct _Glyph3 {
+    u16 pix_width;
+    u32 bitmap_offset;              // From the start of the FONT resource.
 };
 
 struct FntHeader {
-    u16 version;                    // 0x200
+    u16 version;                    // 0x200 or 0x300
     u16 size[2];                    // 0xf76
     char copyright[60];
     u16 type;                       // 0 - Bit 0 is zero, is therefore raster not vector.
@@ -143,9 +154,25 @@ struct FntHeader {
     u32 pad0;                       // 0
     u32 bitmap_offset;              // 0x3fe
     u8 pad1;
-    //        u32 flags;                      // 1=fixed, 2=proportional, 16=1 colour
-    //        u16 abc_spaces[3];
-    //        u32 colour_offset;
-    //        u8 pad2[2];
+};
+
+// Version 0x300 adds these fields, and its glyph table is of _Glyph3.
+struct FntHeader3 {
+    FntHeader base;
+    u32 flags;                      // FNT3_FLAG_*
+    u16 abc_spaces[3];              // A, B and C spacing of every glyph, for ABC fixed fonts.
+    u32 colour_offset;              // Colour palette, for colour fonts.
+    u8 pad2[16];
 };
 #pragma pack(pop)
+
+enum {
+    FNT3_FLAG_FIXED = 0x1,
+    FNT3_FLAG_PROPORTIONAL = 0x2,
+    FNT3_FLAG_ABC_FIXED = 0x4,
+    FNT3_FLAG_ABC_PROPORTIONAL = 0x8,
+    FNT3_FLAG_1_COLOUR = 0x10,
+    FNT3_FLAG_16_COLOUR = 0x20,
+    FNT3_FLAG_256_COLOUR = 0x40,
+    FNT3_FLAG_RGB_COLOUR = 0x80
+};
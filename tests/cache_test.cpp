@@ -0,0 +1,115 @@
+// Checks that the .fon cache only serves entries written with the current
+// CACHE_FORMAT_VERSION, and that a converted font comes back out of it
+// unchanged. Run with an empty scratch directory, which CMakeLists.txt
+// makes for it.
+
+#include "cache.h"
+#include "synth_fon.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+
+static int s_num_failed = 0;
+
+static void Check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "pass" : "FAIL", what);
+    if (!ok) {
+        s_num_failed++;
+    }
+}
+
+
+// Writes an entry the way a build with another CACHE_FORMAT_VERSION would.
+static bool WriteRawEntry(const char *path, u32 version, const char *payload) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    fwrite(&version, sizeof(version), 1, f);
+    fwrite(payload, 1, strlen(payload), f);
+    return fclose(f) == 0;
+}
+
+
+static std::string ToString(const MemBuf *buf) {
+    return std::string((const char *)buf->data, buf->data_num_bytes);
+}
+
+
+// Converts a .fon twice with the same cache_dir. The second conversion must
+// come from the cache, without encoding any fonts, and give the same outputs.
+static void CheckConvertedRoundTrip(const char *dir, Arena *arena) {
+    SynthFonParams params;
+    params.num_sizes = 3;
+    params.min_height = 10;
+    params.max_height = 20;
+    params.proportional = true;
+    MemBuf fon;
+    MakeSynthFon(&fon, params);
+    char *fon_path = arena->Printf("%s/synth.fon", dir);
+    FILE *f = fopen(fon_path, "wb");
+    bool written = f && fwrite(fon.data, 1, fon.data_num_bytes, f) == (size_t)fon.data_num_bytes;
+    if (f) {
+        written = fclose(f) == 0 && written;
+    }
+    Check(written, "synthetic .fon written");
+
+    ConvertOptions opts;
+    opts.out_dir = dir;
+    opts.cache_dir = dir;
+    ConvertMetrics metrics;
+    ConvertContext ctx;
+    ctx.metrics = &metrics;
+    ConvertError err;
+
+    bool ok = ConvertFile(fon_path, opts, &ctx, &err);
+    Check(ok && metrics.num_cache_hits == 0 && ctx.num_fnts_encoded == 3,
+          "first conversion encodes every font");
+    std::string cpp = ToString(&ctx.cpp);
+    std::string h = ToString(&ctx.h);
+    std::string dfbf = ToString(&ctx.dfbf);
+
+    ok = ConvertFile(fon_path, opts, &ctx, &err);
+    Check(ok && metrics.num_cache_hits == 1 && ctx.num_fnts_encoded == 0,
+          "second conversion comes from the cache");
+    Check(!dfbf.empty() && ToString(&ctx.cpp) == cpp && ToString(&ctx.h) == h &&
+          ToString(&ctx.dfbf) == dfbf, "cached outputs match the converted ones");
+    if (!ok) {
+        printf("%s\n", err.msg);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Usage: %s <scratch dir>\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1];
+    const u64 key = 0x0123456789abcdefULL;
+    Arena arena;
+    char *path = arena.Printf("%s/%08x%08x.dfbf", dir, (unsigned)(key >> 32), (unsigned)key);
+
+    MemBuf written;
+    written.PushBytes("payload", 7);
+    WriteCacheEntry(dir, key, ".dfbf", &written, &arena);
+    MemBuf read;
+    bool found = ReadCacheEntry(dir, key, ".dfbf", &read, &arena);
+    Check(found && read.data_num_bytes == 7 && memcmp(read.data, "payload", 7) == 0,
+          "entry of the current version is read back");
+
+    Check(WriteRawEntry(path, 1, "payload"), "version 1 entry written");
+    read.Reset();
+    Check(!ReadCacheEntry(dir, key, ".dfbf", &read, &arena), "version 1 entry is rejected");
+
+    Check(WriteRawEntry(path, CACHE_FORMAT_VERSION + 1, "payload"), "newer entry written");
+    read.Reset();
+    Check(!ReadCacheEntry(dir, key, ".dfbf", &read, &arena), "newer entry is rejected");
+
+    remove(path);
+
+    CheckConvertedRoundTrip(dir, &arena);
+    return s_num_failed ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+// Checks that the .dfbf decoder rejects malformed version 1 glyph indexes
+// rather than reading or writing past its tables.
+
+#include "dfbf_decoder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+static int s_num_failed = 0;
+
+static void Check(bool ok, const char *what) {
+    printf("%s: %s\n", ok ? "pass" : "FAIL", what);
+    if (!ok) {
+        s_num_failed++;
+    }
+}
+
+
+// A version 1 blob of an 8x8 fixed font with a glyph reference table. Every
+// glyph uses bitmap ref, of num_bitmaps, and every bitmap is empty.
+static void MakeRefsBlob(std::vector<u8> *blob, int num_bitmaps, int ref) {
+    blob->clear();
+    blob->push_back(8);
+    blob->push_back(8);
+    blob->push_back(DFBF_FLAG_GLYPH_REFS);
+    blob->push_back((u8)num_bitmaps);
+    blob->insert(blob->end(), 224, (u8)ref);
+    blob->insert(blob->end(), (num_bitmaps + 1) * 2, 0);
+}
+
+
+int main() {
+    std::vector<u8> blob;
+    ConvertError err;
+
+    MakeRefsBlob(&blob, 1, 0);
+    DecodedFont font;
+    Check(DecodeDfbfBlob(ByteView(&blob[0], blob.size()), 1, &font, &err), "well formed blob decodes");
+
+    // The refs are all below the count, so only the count check stops the
+    // decoder indexing its per bitmap arrays with 254.
+    MakeRefsBlob(&blob, 255, 254);
+    DecodedFont font_255;
+    Check(!DecodeDfbfBlob(ByteView(&blob[0], blob.size()), 1, &font_255, &err),
+          "blob with 255 bitmaps is rejected");
+    GlyphSheet glyph(8, 8);
+    Check(!DecodeDfbfGlyph(ByteView(&blob[0], blob.size()), 0, &glyph, &err),
+          "glyph of a blob with 255 bitmaps is rejected");
+
+    MakeRefsBlob(&blob, 0, 0);
+    DecodedFont font_0;
+    Check(!DecodeDfbfBlob(ByteView(&blob[0], blob.size()), 1, &font_0, &err),
+          "blob with no bitmaps is rejected");
+
+    return s_num_failed ? 1 : 0;
+}